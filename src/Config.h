@@ -0,0 +1,97 @@
+#pragma once
+
+/// ///////////////////// ///
+///	Build-time options    ///
+/// ///////////////////// ///
+
+// Every option can be overridden from the compiler command line (e.g. /D CPU_SWITCH_DISPATCH=0)
+
+// CPU dispatch core
+// 0 : Instructions are dispatched through the 'instructions' and 'prefixed' tables of member function pointers
+// 1 : Instructions are dispatched through one flat switch over the 512 opcodes, with address mode and operation fused
+#ifndef CPU_SWITCH_DISPATCH
+#define CPU_SWITCH_DISPATCH 1
+#endif
+
+// ALU flags evaluation
+// 0 : Z/N/H/C are written to F by every ALU operation
+// 1 : The last ALU operation and its operands are recorded, and F is only computed when it is read
+//     (conditions, PUSH AF, DAA, ADC/SBC, CCF, ...), or when CPU::syncFlags() is called
+#ifndef CPU_LAZY_FLAGS
+#define CPU_LAZY_FLAGS 1
+#endif
+
+// Predecoded blocks cache
+// 0 : Instructions and their operands are always read from the bus
+// 1 : Each CPU can be switched to a cache of predecoded blocks with CPU::setBlockCache() (disabled by default)
+#ifndef CPU_BLOCK_CACHE
+#define CPU_BLOCK_CACHE 1
+#endif
+
+// Dynamic recompiler (x86-64 only)
+// 0 : Code is always interpreted
+// 1 : Each CPU can be switched to compiling hot blocks of ROM code to x86-64 with CPU::setRecompiler() (disabled by default)
+#ifndef CPU_JIT
+#if defined(_M_X64) || defined(__x86_64__)
+#define CPU_JIT 1
+#else
+#define CPU_JIT 0
+#endif
+#endif
+
+// Instructions fusion
+// 0 : Every instruction is dispatched on its own
+// 1 : Frequent sequences (DEC r8 / JR NZ, CP n8 / JR cc, ...) are run by step() as one fused handler,
+//     when no interrupt can be requested in between (enabled by default, see CPU::setFusion())
+#ifndef CPU_FUSION
+#define CPU_FUSION 1
+#endif
+
+// Opcode pairs histogram
+// 0 : Not recorded
+// 1 : Every pair of consecutive opcodes executed is counted, to be printed with CPU::dumpFusions()
+#ifndef CPU_PAIR_HISTOGRAM
+#define CPU_PAIR_HISTOGRAM 0
+#endif
+
+// Polling loops skipping
+// 0 : Polling loops are run like any other code
+// 1 : step() jumps over the iterations of side-effect free polling loops (LD A, [addr] / CP n8 / JR cc, ...) during which
+//     the polled value can't change (enabled by default, see CPU::setIdleSkip())
+#ifndef CPU_IDLE_SKIP
+#define CPU_IDLE_SKIP 1
+#endif
+
+// Instructions timing of step()
+// 0 : The M-cycles of an instruction are all advanced before it does its bus accesses at once
+// 1 : Each bus access (and internal delay) of an instruction advances the other components by one M-cycle,
+//     so timer registers are read and written on the M-cycle they are on hardware. Interrupts are checked once the
+//     opcode is fetched, and an interrupt dispatch takes 5 M-cycles instead of the instruction
+#ifndef CPU_CYCLE_ACCURATE
+#define CPU_CYCLE_ACCURATE 0
+#endif
+
+// Timer emulation
+// 0 : The timer is clocked on every M-cycle
+// 1 : The timer is only synced when its registers are accessed or its interrupt is due, DIV and TIMA are computed from
+//     the M-cycles elapsed since the last sync, and the next interrupt is scheduled as a single event
+#ifndef TIMER_LAZY
+#define TIMER_LAZY 1
+#endif
+
+// Debug hooks
+// 0 : No debugging code is compiled in the CPU
+// 1 : Callbacks for retired instructions, bus accesses, interrupt dispatches and unsupported opcodes
+//     can be attached to a CPU with CPU::setDebugHooks() (see DebugHooks)
+#ifndef DEBUG_HOOKS
+#define DEBUG_HOOKS 0
+#endif
+
+// Cartridge ROM loading
+// 0 : The ROM file is read in a buffer
+// 1 : The ROM file is mapped read-only in memory, so its pages are held by the system file cache and shared with the other
+//     processes running the same ROM (falls back to the buffer if the file can't be mapped). The whole file is still read
+//     once when it is first loaded, to be hashed by the ROM cache
+#ifndef CARTRIDGE_MMAP
+#define CARTRIDGE_MMAP 1
+#endif
@@ -1,5 +1,9 @@
 #include "Gameboy.h"
 
+#if DEBUG_HOOKS
+#include <iomanip>
+#endif
+
 Gameboy::Gameboy(std::string filename)
 	: bus(), cpu(), cart(filename) {
 	bus.connectCartridge(&cart);
@@ -14,49 +18,50 @@ Gameboy::~Gameboy() {
 }
 
 void Gameboy::start() {
-	std::ofstream ofs("output.txt", std::ofstream::out);
-
 	while (!cpu.isStop) {
-		/*
-		if (cpu.cycles == 1) {
-			ofs
-				<< "A:" << std::hex << std::uppercase << std::setw(2) << std::setfill('0') << (int)cpu.registers.AF.hi
-				<< " F:" << std::hex << std::uppercase << std::setw(2) << std::setfill('0') << (int)cpu.registers.AF.lo
-				<< " B:" << std::hex << std::uppercase << std::setw(2) << std::setfill('0') << (int)cpu.registers.BC.hi
-				<< " C:" << std::hex << std::uppercase << std::setw(2) << std::setfill('0') << (int)cpu.registers.BC.lo
-				<< " D:" << std::hex << std::uppercase << std::setw(2) << std::setfill('0') << (int)cpu.registers.DE.hi
-				<< " E:" << std::hex << std::uppercase << std::setw(2) << std::setfill('0') << (int)cpu.registers.DE.lo
-				<< " H:" << std::hex << std::uppercase << std::setw(2) << std::setfill('0') << (int)cpu.registers.HL.hi
-				<< " L:" << std::hex << std::uppercase << std::setw(2) << std::setfill('0') << (int)cpu.registers.HL.lo
-				<< " SP:" << std::hex << std::uppercase << std::setw(4) << std::setfill('0') << (int)cpu.registers.SP
-				<< " PC:" << std::hex << std::uppercase << std::setw(4) << std::setfill('0') << (int)cpu.registers.PC
-				<< " PCMEM:"
-					<< std::hex << std::uppercase << std::setw(2) << std::setfill('0') << (int)bus.read(cpu.registers.PC) << ","
-					<< std::hex << std::uppercase << std::setw(2) << std::setfill('0') << (int)bus.read(cpu.registers.PC + 1) << ","
-					<< std::hex << std::uppercase << std::setw(2) << std::setfill('0') << (int)bus.read(cpu.registers.PC + 2) << ","
-					<< std::hex << std::uppercase << std::setw(2) << std::setfill('0') << (int)bus.read(cpu.registers.PC + 3)
-				<< std::endl;
-		}
-		//*/
-		/*/
-		if (cpu.cycles == 1) {
-			std::cout << "";
-			if (cpu.registers.PC == 0x016A)
-				std::cout << "";
-			if (cpu.registers.PC == 0x0267)
-				std::cout << "";
-			if (cpu.registers.PC == 0x0274)
-				std::cout << "";
-		}
-		//*/
-		bus.clock();
+		bus.step();
 	}
+}
 
-	ofs.close();
+#if DEBUG_HOOKS
+// Log the CPU state before each instruction to a file (Gameboy Doctor format)
+// Fusion, polling loops skipping and the recompiler are disabled so that every instruction is logged
+// An interrupt dispatch is not an instruction, the line after it is the first instruction of the handler
+void Gameboy::trace(const std::string& filename) {
+	traceFile.open(filename.c_str(), std::ofstream::out);
 
-	/*
-	for (int i = 0; i < 100000; i++) {
-		gb.clock();
-	}
-	*/
-}
\ No newline at end of file
+	hooks.context = this;
+	hooks.onExecute = traceInstruction;
+
+	cpu.setFusion(false);
+	cpu.setIdleSkip(false);
+	cpu.setRecompiler(false);
+	cpu.setDebugHooks(&hooks);
+}
+
+void Gameboy::traceInstruction(void* context, uint16_t pc, [[maybe_unused]] uint8_t opcode) {
+	Gameboy* gb = static_cast<Gameboy*>(context);
+	CPU<Bus>& cpu = gb->cpu;
+
+	cpu.syncFlags();
+
+	gb->traceFile
+		<< std::hex << std::uppercase << std::setfill('0')
+		<< "A:" << std::setw(2) << (int)cpu.registers.AF.hi
+		<< " F:" << std::setw(2) << (int)cpu.registers.AF.lo
+		<< " B:" << std::setw(2) << (int)cpu.registers.BC.hi
+		<< " C:" << std::setw(2) << (int)cpu.registers.BC.lo
+		<< " D:" << std::setw(2) << (int)cpu.registers.DE.hi
+		<< " E:" << std::setw(2) << (int)cpu.registers.DE.lo
+		<< " H:" << std::setw(2) << (int)cpu.registers.HL.hi
+		<< " L:" << std::setw(2) << (int)cpu.registers.HL.lo
+		<< " SP:" << std::setw(4) << (int)cpu.registers.SP
+		<< " PC:" << std::setw(4) << (int)pc
+		<< " PCMEM:"
+			<< std::setw(2) << (int)gb->bus.read(pc) << ","
+			<< std::setw(2) << (int)gb->bus.read(pc + 1) << ","
+			<< std::setw(2) << (int)gb->bus.read(pc + 2) << ","
+			<< std::setw(2) << (int)gb->bus.read(pc + 3)
+		<< std::endl;
+}
+#endif
@@ -1,23 +1,37 @@
 #pragma once
 
 #include <cstdint>
+#include <fstream>
 #include <string>
 
 #include "./components/Bus.h"
 #include "./components/CPU.h"
 #include "./components/Cartridge.h"
+#include "./components/DebugHooks.h"
 
 class Gameboy
 {
 public:
 	Bus bus;
-	CPU cpu;
+	CPU<Bus> cpu;
 	Cartridge cart;
 	Serial serial;
 
+#if DEBUG_HOOKS
+	DebugHooks hooks;
+	std::ofstream traceFile;
+#endif
+
 public:
 	Gameboy(std::string filename);
 	~Gameboy();
 
 	void start();
+
+#if DEBUG_HOOKS
+	void trace(const std::string& filename);
+
+private:
+	static void traceInstruction(void* context, uint16_t pc, uint8_t opcode);
+#endif
 };
\ No newline at end of file
@@ -0,0 +1,154 @@
+#include "BlockCache.h"
+
+#include <algorithm>
+
+#include "Bus.h"
+
+BlockCache::BlockCache(Bus* b) {
+	bus = b;
+}
+
+BlockCache::~BlockCache() {
+
+}
+
+// Block starting at PC, decoded on the first lookup (nullptr if PC is not in a cacheable region)
+const BlockCache::cache_block_t* BlockCache::lookup(uint16_t pc) {
+	if (getRegion(pc) < 0) {
+		uncached++;
+		return nullptr;
+	}
+
+	// Blocks in RAM are always in bank 0
+	uint32_t key = (pc < 0x8000 ? (uint32_t)bus->cart->getRomBank(pc) << 16 : 0) | pc;
+
+	auto it = blocks.find(key);
+
+	if (it != blocks.end()) {
+		hits++;
+	}
+	else {
+		misses++;
+
+		it = blocks.emplace(key, cache_block_t()).first;
+		decode(it->second, pc);
+
+		// Blocks in RAM are registered in the pages they span so writes can find them
+		if (pc >= 0x8000) {
+			for (uint16_t page = it->second.start >> 8; page <= ((it->second.end - 1) >> 8); page++) {
+				codePages[page].push_back(key);
+			}
+		}
+	}
+
+	// A block can be empty if its first instruction crosses the end of its region
+	return it->second.uops.empty() ? nullptr : &it->second;
+}
+
+// Drop the blocks containing the address, return true if any was dropped
+bool BlockCache::invalidate(uint16_t addr) {
+	std::vector<uint32_t>& keys = codePages[addr >> 8];
+
+	if (keys.empty()) {
+		return false;
+	}
+
+	std::vector<uint32_t> erased;
+
+	for (uint32_t key : keys) {
+		const cache_block_t& block = blocks.at(key);
+
+		if (addr >= block.start && addr < block.end) {
+			erased.push_back(key);
+		}
+	}
+
+	for (uint32_t key : erased) {
+		erase(key);
+	}
+
+	return !erased.empty();
+}
+
+void BlockCache::clear() {
+	blocks.clear();
+
+	for (uint16_t page = 0; page < 0x100; page++) {
+		codePages[page].clear();
+	}
+}
+
+size_t BlockCache::getBlockCount() const {
+	return blocks.size();
+}
+
+// Decode instructions from PC up to a control flow instruction, the end of the region or the maximum block length
+void BlockCache::decode(cache_block_t& block, uint16_t pc) {
+	int8_t region = getRegion(pc);
+
+	block.start = pc;
+
+	while (block.uops.size() < maxBlockLength) {
+		uint8_t opcode = bus->read(pc);
+		uint8_t length = lengths[opcode];
+
+		// The whole instruction has to be in the region of the block
+		if (getRegion(pc + length - 1) != region) {
+			break;
+		}
+
+		cache_uop_t uop = { pc, opcode, { 0x00, 0x00 }, length };
+
+		for (uint8_t i = 1; i < length; i++) {
+			uop.operands[i - 1] = bus->read(pc + i);
+		}
+
+		block.uops.push_back(uop);
+		pc += length;
+
+		if (isBlockEnd(opcode)) {
+			break;
+		}
+	}
+
+	block.end = pc;
+}
+
+void BlockCache::erase(uint32_t key) {
+	const cache_block_t& block = blocks.at(key);
+
+	for (uint16_t page = block.start >> 8; page <= ((block.end - 1) >> 8); page++) {
+		std::vector<uint32_t>& keys = codePages[page];
+		keys.erase(std::remove(keys.begin(), keys.end(), key), keys.end());
+	}
+
+	blocks.erase(key);
+	invalidations++;
+}
+
+// Cacheable regions: 0 for ROM bank 00, 1 for switchable ROM bank, 2 for Work RAM and 3 for High RAM (-1 otherwise)
+int8_t BlockCache::getRegion(uint16_t addr) {
+	if (addr <= 0x3FFF)						return 0;
+	if (addr <= 0x7FFF)						return 1;
+	if (addr >= 0xC000 && addr <= 0xDFFF)	return 2;
+	if (addr >= 0xFF80 && addr <= 0xFFFE)	return 3;
+
+	return -1;
+}
+
+// Instructions after which PC is not the next instruction (jumps, calls, returns, HALT, STOP and illegal opcodes)
+bool BlockCache::isBlockEnd(uint8_t opcode) {
+	switch (opcode) {
+	case 0x10: case 0x76:												// STOP, HALT
+	case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:				// JR
+	case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA: case 0xE9:	// JP
+	case 0xC4: case 0xCC: case 0xCD: case 0xD4: case 0xDC:				// CALL
+	case 0xC0: case 0xC8: case 0xC9: case 0xD0: case 0xD8: case 0xD9:	// RET, RETI
+	case 0xC7: case 0xCF: case 0xD7: case 0xDF: case 0xE7: case 0xEF: case 0xF7: case 0xFF:	// RST
+	case 0xD3: case 0xDB: case 0xDD: case 0xE3: case 0xE4: case 0xEB: case 0xEC: case 0xED:	// Illegal
+	case 0xF4: case 0xFC: case 0xFD:
+		return true;
+	}
+
+	return false;
+}
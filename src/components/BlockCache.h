@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+class Bus;
+
+// Cache of predecoded straight-line blocks of code, keyed by mapped ROM bank and PC
+// Blocks are decoded from ROM, Work RAM and High RAM only, blocks in RAM are dropped when one of their bytes is written
+class BlockCache
+{
+public:
+	// Predecoded instruction
+	struct cache_uop_t {
+		uint16_t pc;
+		uint8_t opcode;
+		uint8_t operands[2];	// Bytes following the opcode (the prefixed opcode for 0xCB)
+		uint8_t length;
+	};
+
+	struct cache_block_t {
+		uint16_t start;
+		uint16_t end;			// Address following the last instruction
+		std::vector<cache_uop_t> uops;
+	};
+
+	static constexpr uint8_t maxBlockLength = 32;	// Maximum number of instructions in a block
+
+	// Statistics
+	uint64_t hits = 0;				// Lookups of an already decoded block
+	uint64_t misses = 0;			// Lookups that decoded a new block
+	uint64_t invalidations = 0;		// Blocks dropped because their code was written to
+	uint64_t uncached = 0;			// Lookups outside of ROM, Work RAM and High RAM
+
+private:
+	Bus* bus = nullptr;
+
+	std::unordered_map<uint32_t, cache_block_t> blocks;
+	std::vector<uint32_t> codePages[0x100];	// Keys of the blocks in each 256-byte page of RAM
+
+public:
+	BlockCache(Bus* b);
+	~BlockCache();
+
+	const cache_block_t* lookup(uint16_t pc);
+	bool invalidate(uint16_t addr);
+	void clear();
+
+	size_t getBlockCount() const;
+
+private:
+	void decode(cache_block_t& block, uint16_t pc);
+	void erase(uint32_t key);
+
+	static int8_t getRegion(uint16_t addr);
+	static bool isBlockEnd(uint8_t opcode);
+
+	// Length in bytes of each instruction (0xCB counts its prefixed opcode)
+	static constexpr uint8_t lengths[0x100] = {
+/*		 x0 x1 x2 x3 x4 x5 x6 x7 x8 x9 xA xB xC xD xE xF */
+/* 0x */ 1, 3, 1, 1, 1, 1, 2, 1, 3, 1, 1, 1, 1, 1, 2, 1,
+/* 1x */ 2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+/* 2x */ 2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+/* 3x */ 2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+/* 4x */ 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+/* 5x */ 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+/* 6x */ 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+/* 7x */ 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+/* 8x */ 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+/* 9x */ 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+/* Ax */ 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+/* Bx */ 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+/* Cx */ 1, 1, 3, 3, 3, 1, 2, 1, 1, 1, 3, 2, 3, 3, 2, 1,
+/* Dx */ 1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 1, 2, 1,
+/* Ex */ 2, 1, 1, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1,
+/* Fx */ 2, 1, 1, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1
+	};
+};
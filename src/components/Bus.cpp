@@ -8,13 +8,18 @@ Bus::Bus() {
 	for (uint16_t i = 0; i < 0x7F; i++) {
 		hRam[i] = 0x00;
 	}
+
+	mapPages(0xC0, 0x20, wRam, wRam);	// Work RAM (8 KiB)
+
+	mapIO<InterruptController, &InterruptController::read, &InterruptController::write>(0xFF0F, 0xFF0F, &interrupts, 0xE0);	// Interrupt flags
+	setUnusedBits(0xFF44, 0xFF);	// LY - hardcoded return peding LCD implementation (0x90 for Blargg, 0xFF for Mooneye)
 }
 
 Bus::~Bus() {
 
 }
 
-void Bus::connectCPU(CPU* c) {
+void Bus::connectCPU(CPU<Bus>* c) {
 	timer.connectBus(this);
 
 	cpu = c;	
@@ -23,107 +28,203 @@ void Bus::connectCPU(CPU* c) {
 
 void Bus::connectCartridge(Cartridge* c) {
 	cart = c;
+
+	mapCartridge();
+
+	if (cart->rtc) {
+		cart->rtc->connectClock(&scheduler.now);
+	}
+
+	// Saved RAM is committed periodically so it's written to the save file even if the cartridge is never destroyed
+	if (cart->save) {
+		scheduler.schedule(Scheduler::cartridge, scheduler.now + Cartridge::saveCommitPeriod);
+	}
+	else {
+		scheduler.cancel(Scheduler::cartridge);
+	}
 }
 
 void Bus::connectSerial(Serial* s) {
 	serial = s;
+	serial->connectBus(this);
 }
 
 void Bus::clock() {
-	// Timers are incremented only if CPU is not stopped
-	if (!cpu->isStop) {
-		timer.clock();
-	}
+	advance(1);
 
-	if (cpu->cycles == 1) {				//TODO remove ater testing CPU
-		std::cout << "";
-	
-		if (cpu->registers.PC == 0x01B2)
-			std::cout << "";			
-	}
-	
 	cpu->clock();
+}
 
-	clockCounter++;
+// Run the CPU for a whole instruction, the other components are advanced by the CPU through advance()
+void Bus::step() {
+	cpu->step();
 }
 
-uint8_t Bus::read(uint16_t addr) {
-	if (addr >= 0x0000 && addr <= 0x3FFF) {			// From Cartridge - ROM Bank 00
-		return cart->read(addr);
-	}
-	else if (addr >= 0x4000 && addr <= 0x7FFF) {	// From Cartridge - ROM Switchable bank via mapper
-		return cart->read(addr);
+// Run the events due at the current M-cycle
+void Bus::runEvents() {
+	while (scheduler.isDue()) {
+		switch (scheduler.pop())
+		{
+#if TIMER_LAZY
+		case Scheduler::timer:
+			timer.sync();
+			timer.schedule();
+			break;
+#endif
+		case Scheduler::cartridge:
+			if (cart->commitSave()) {
+				mapCartridge();
+			}
+			scheduler.schedule(Scheduler::cartridge, scheduler.now + Cartridge::saveCommitPeriod);
+			break;
+		default:
+			break;
+		}
 	}
-	else if (addr >= 0xA000 && addr <= 0xBFFF) {	// From Cartridge - RAM switchable bank
-		cart->read(addr);
+}
+
+// Map host memory to a range of pages, nullptr sends the accesses to readUnmapped() or writeUnmapped()
+void Bus::mapPages(uint8_t first, uint16_t count, const uint8_t* readMemory, uint8_t* writeMemory) {
+	for (uint16_t i = 0; i < count; i++) {
+		readPages[first + i] = readMemory ? readMemory + (i << 8) : nullptr;
+		writePages[first + i] = writeMemory ? writeMemory + (i << 8) : nullptr;
 	}
-	else if (addr >= 0xC000 && addr <= 0xDFFF) {	// Work RAM (8 KiB)
-		return wRam[addr - 0xC000];
+}
+
+// Map the ROM and RAM banks selected by the cartridge mapper, to be called each time they are switched
+// ROM is read-only, writes still go to the cartridge (mapper registers) through writeUnmapped()
+void Bus::mapCartridge() {
+	for (uint16_t page = 0x00; page < 0x80; page++) {
+		readPages[page] = cart->getRomPage(page << 8);
 	}
-	else if (addr >= 0xFF01 && addr <= 0xFF02) {	// Serial port
-		return serial->read(addr);
+
+	// External RAM (disabled RAM is unmapped)
+	for (uint16_t page = 0xA0; page < 0xC0; page++) {
+		readPages[page] = cart->banks.ramWindow ? cart->banks.ramWindow + ((page - 0xA0) << 8) : nullptr;
+		writePages[page] = cart->getRamWritePage(page << 8);
 	}
-	else if (addr >= 0xFF04 && addr <= 0xFF07) {	// Timer register
-		return timer.read(addr);
+}
+
+// Bits of an I/O register always read as 1, a register without device reads as this value
+void Bus::setUnusedBits(uint16_t addr, uint8_t unusedBits) {
+	ioRegisters[addr & 0x7F].unusedBits = unusedBits;
+}
+
+// Accesses to the pages without host memory
+uint8_t Bus::readUnmapped(uint16_t addr) {
+	if (addr >= 0xFF00 && addr <= 0xFF7F) {			// I/O registers
+		return readIO(addr);
 	}
-	else if (addr == 0xFF44) {						// LY - hardcoded return peding LCD implementation
-		// return 0x90; // Blaggrs
-		return 0xFF; // Mooneye
+	else if (addr >= 0x0000 && addr <= 0x3FFF) {	// From Cartridge - ROM Bank 00
+		return cart->read(addr);
 	}
-	else if (addr == 0xFF02) {						// hardcoded return peding LCD implementation
-		return 0xFF; // Mooneye
+	else if (addr >= 0x4000 && addr <= 0x7FFF) {	// From Cartridge - ROM Switchable bank via mapper
+		return cart->read(addr);
 	}
-	else if (addr == 0xFF0F) {						// Interrupt flags
-		return interruptFlags;
+	else if (addr >= 0xA000 && addr <= 0xBFFF) {	// From Cartridge - RAM switchable bank
+		return cart->read(addr);
 	}
 	else if (addr >= 0xFF80 && addr <= 0xFFFE) {	// High Ram
 		return hRam[addr - 0xFF80];
 	}
 	else if (addr == 0xFFFF) {						// Interrupt enable
-		return interruptEnable;
+		return interrupts.getEnable();
 	}
 
 	return 0x00;
 }
 
-void Bus::write(uint16_t addr, uint8_t data) {
-	if (addr >= 0x0000 && addr <= 0x3FFF) {			// From Cartridge - ROM Bank 00
-		cart->write(addr, data);
-	}
-	else if (addr >= 0x4000 && addr <= 0x7FFF) {	// From Cartridge - ROM Switchable bank via mapper
-		cart->write(addr, data);
+// Number of M-cycles until the value at the address can change without being written by the CPU (UINT32_MAX if it can't)
+uint32_t Bus::getCyclesToChange(uint16_t addr) {
+	// Timer is stopped along with the CPU
+	if (timer.isStopped) {
+		return UINT32_MAX;
 	}
-	else if (addr >= 0xA000 && addr <= 0xBFFF) {	// From Cartridge - RAM switchable bank
-		cart->write(addr, data);
+
+	if (addr >= 0xFF04 && addr <= 0xFF07) {			// Timer register
+#if TIMER_LAZY
+		timer.sync();
+#endif
+		return timer.getCyclesToChange(addr);
 	}
-	else if (addr >= 0xC000 && addr <= 0xDFFF) {	// Work RAM (8 KiB)
-		wRam[addr - 0xC000] = data;
+	else if (addr == 0xFF0F) {						// Interrupt flags
+		return getCyclesToInterrupt();
 	}
-	else if (addr >= 0xFF01 && addr <= 0xFF02) {	// Serial port
-		serial->write(addr, data);
+
+	return UINT32_MAX;
+}
+
+void Bus::writeUnmapped(uint16_t addr, uint8_t data) {
+	if (addr >= 0xFF00 && addr <= 0xFF7F) {			// I/O registers
+		writeIO(addr, data);
 	}
-	else if (addr >= 0xFF04 && addr <= 0xFF07) {	// Timer register
-		timer.write(addr, data);
+	else if (addr >= 0x0000 && addr <= 0x7FFF) {	// From Cartridge - Mapper registers
+		if (cart->write(addr, data)) {
+			mapCartridge();
+		}
 	}
-	else if (addr == 0xFF0F) {						// Interrupt flags
-		interruptFlags = data;
+	else if (addr >= 0xA000 && addr <= 0xBFFF) {	// From Cartridge - RAM switchable bank
+		if (cart->write(addr, data)) {
+			mapCartridge();
+		}
 	}
 	else if (addr >= 0xFF80 && addr <= 0xFFFE) {	// High Ram
 		hRam[addr - 0xFF80] = data;
 	}
 	else if (addr == 0xFFFF) {						// Interrupt enable
-		interruptEnable = data;
+		interrupts.setEnable(data);
 	}
 }
 
-void Bus::clearInterruptFlag(uint8_t mask) {
-	interruptFlags &= ~mask;
+uint8_t Bus::readIO(uint16_t addr) {
+	const io_register_t& reg = ioRegisters[addr & 0x7F];
+
+	if (!reg.read) {
+		return reg.unusedBits;
+	}
+
+	if (reg.sync) {
+		reg.sync(reg.device);
+	}
+
+	return reg.read(reg.device, addr) | reg.unusedBits;
+}
+
+void Bus::writeIO(uint16_t addr, uint8_t data) {
+	const io_register_t& reg = ioRegisters[addr & 0x7F];
+
+	if (!reg.write) {
+		return;
+	}
+
+	if (reg.sync) {
+		reg.sync(reg.device);
+	}
+
+	reg.write(reg.device, addr, data);
+}
+
+// Number of M-cycles until the timer requests an interrupt
+uint32_t Bus::getCyclesToInterrupt() const {
+#if TIMER_LAZY
+	uint64_t deadline = scheduler.getDeadline(Scheduler::timer);
+
+	if (deadline == Scheduler::never) {
+		return UINT32_MAX;
+	}
+
+	return (uint32_t)(deadline - scheduler.now);
+#else
+	return timer.getCyclesToInterrupt();
+#endif
 }
 
-uint8_t Bus::getInterruptFlags() const {
-	return interruptFlags;
+// ROM bank mapped at the address by the cartridge
+uint16_t Bus::getRomBank(uint16_t addr) const {
+	return cart->getRomBank(addr);
 }
 
-uint8_t Bus::getInterruptEnable() const {
-	return interruptEnable;
+// CPU entered (or left on reset) its STOP mode, the timer is stopped along with it
+void Bus::setStopped(bool stopped) {
+	timer.setStopped(stopped);
 }
@@ -5,47 +5,139 @@
 #include "../utils/Timer.h"
 #include "CPU.h"
 #include "Cartridge.h"
+#include "InterruptController.h"
+#include "Scheduler.h"
 #include "../io/Serial.h"
 
-class Bus
+class alignas(64) Bus
 {
 public:
-	enum interrupt_flags_t {
-		j = (1 << 4),
-		s = (1 << 3),
-		t = (1 << 2),
-		l = (1 << 1),
-		v = 1
+	static constexpr bool hasRom = true;	// 0x0000-0x7FFF is mapped to the cartridge ROM
+
+	// Handlers of an I/O register (0xFF00-0xFF7F), registered by the device owning it
+	struct io_register_t {
+		void* device = nullptr;
+		uint8_t(*read)(void* device, uint16_t addr) = nullptr;			// Register reads as 0x00 without one
+		void(*write)(void* device, uint16_t addr, uint8_t data) = nullptr;	// Writes are ignored without one
+		void(*sync)(void* device) = nullptr;							// Brings the device up to date before an access
+		uint8_t unusedBits = 0x00;										// Bits always read as 1
 	};
 
+	// Hot state first: the clock and interrupts (checked on each instruction) share the first cache line,
+	// then come the page tables of every memory access
+	Scheduler scheduler;
+	InterruptController interrupts;
+
+private:
+	// Host memory mapped at each 256-byte page of the address space
+	// Pages without one (I/O registers and High RAM, regions not emulated yet) go through readUnmapped() and writeUnmapped()
+	const uint8_t* readPages[0x100] = {};
+	uint8_t* writePages[0x100] = {};
+
+	io_register_t ioRegisters[0x80];
+
+public:
+	uint8_t hRam[0x7F];
+
 	Timer timer;
-	CPU* cpu = nullptr;
+	CPU<Bus>* cpu = nullptr;
 	Cartridge* cart = nullptr;
 	Serial* serial = nullptr;
 
-	uint8_t interruptEnable = 0x00;
-	uint8_t interruptFlags = 0x00;
-
 	uint8_t wRam[0x2000];
-	uint8_t hRam[0x7F];
-
-	uint32_t clockCounter = 0;
 
 public:
 	Bus();
 	~Bus();
 
-	void connectCPU(CPU* c);
+	void connectCPU(CPU<Bus>* c);
 	void connectCartridge(Cartridge* c);
 	void connectSerial(Serial* s);
 
 	void clock();
+	void step();
+	// Advance every component but the CPU by a number of M-cycles
+	// Components are only run if one of their events is due
+	void advance(uint8_t cycles) {
+#if !TIMER_LAZY
+		if (!timer.isStopped) {
+			for (uint8_t i = 0; i < cycles; i++) {
+				timer.clock();
+			}
+		}
+#endif
+
+		scheduler.now += cycles;
+
+		if (scheduler.isDue()) {
+			runEvents();
+		}
+	}
+
+	// Same as advance() for a number of M-cycles during which no interrupt is requested
+	void fastForward(uint32_t cycles) {
+#if !TIMER_LAZY
+		if (!timer.isStopped) {
+			timer.fastForward(cycles);
+		}
+#endif
+
+		scheduler.now += cycles;
+	}
+
+	uint8_t read(uint16_t addr) {
+		const uint8_t* page = readPages[addr >> 8];
+		return page ? page[addr & 0xFF] : readUnmapped(addr);
+	}
+
+	void write(uint16_t addr, uint8_t data) {
+		uint8_t* page = writePages[addr >> 8];
+
+		if (page) {
+			page[addr & 0xFF] = data;
+		}
+		else {
+			writeUnmapped(addr, data);
+		}
+	}
+
+	uint32_t getCyclesToChange(uint16_t addr);
+
+	uint32_t getCyclesToInterrupt() const;
+	uint16_t getRomBank(uint16_t addr) const;
+	void setStopped(bool stopped);
+
+	void mapPages(uint8_t first, uint16_t count, const uint8_t* readMemory, uint8_t* writeMemory);
+
+	// Register the member functions of a device as the handlers of the I/O registers from first to last
+	template<class Device, uint8_t(Device::*Read)(uint16_t), void(Device::*Write)(uint16_t, uint8_t), void(Device::*Sync)() = nullptr>
+	void mapIO(uint16_t first, uint16_t last, Device* device, uint8_t unusedBits = 0x00) {
+		for (uint16_t addr = first; addr <= last; addr++) {
+			io_register_t& reg = ioRegisters[addr & 0x7F];
+
+			reg.device = device;
+			reg.read = [](void* d, uint16_t a) { return (static_cast<Device*>(d)->*Read)(a); };
+			reg.write = [](void* d, uint16_t a, uint8_t v) { (static_cast<Device*>(d)->*Write)(a, v); };
+			reg.sync = nullptr;
+			reg.unusedBits = unusedBits;
+
+			if constexpr (Sync != nullptr) {
+				reg.sync = [](void* d) { (static_cast<Device*>(d)->*Sync)(); };
+			}
+		}
+	}
+
+	void setUnusedBits(uint16_t addr, uint8_t unusedBits);
+
+private:
+	void mapCartridge();
+
+	void runEvents();
 
-	uint8_t read(uint16_t addr);
-	void write(uint16_t addr, uint8_t data);
+	uint8_t readUnmapped(uint16_t addr);
+	void writeUnmapped(uint16_t addr, uint8_t data);
 
-	void clearInterruptFlag(uint8_t mask);
-	uint8_t getInterruptFlags() const;
-	uint8_t getInterruptEnable() const;
+	uint8_t readIO(uint16_t addr);
+	void writeIO(uint16_t addr, uint8_t data);
 };
 
@@ -1,14 +1,46 @@
 #include "CPU.h"
 
-#include <iostream>
+#include <algorithm>
+#include <iomanip>
+#include <numeric>
 
 #include "Bus.h"
+#include "DebugHooks.h"
+#include "FlatMemory.h"
 
-void CPU::connectBus(Bus* b) {
+#if CPU_FUSION
+// First opcodes of the fused sequences
+static inline bool isFusionStart(uint8_t opcode) {
+	return ((opcode & 0xC7) == 0x05 && opcode != 0x35)	// DEC r8
+		|| opcode == 0xFE								// CP n8
+		|| opcode == 0xF0								// LDH A, [n8]
+		|| opcode == 0x2A;								// LD A, [HL+]
+}
+
+static inline bool isJrCond(uint8_t opcode) {
+	return (opcode & 0xE7) == 0x20;
+}
+#endif
+
+template<class Memory>
+CPU<Memory>::~CPU() {
+#if CPU_BLOCK_CACHE
+	delete blockCache;
+#endif
+
+#if CPU_JIT
+	delete recompiler;
+#endif
+}
+
+template<class Memory>
+void CPU<Memory>::connectBus(Memory* b) {
 	bus = b;
+	interrupts = &b->interrupts;
 }
 
-void CPU::reset() {
+template<class Memory>
+void CPU<Memory>::reset() {
 	// Exemple of CPU state with bootrom DMG0
 	registers.AF.full = 0x01B0;
 	registers.BC.full = 0x0013;
@@ -24,14 +56,41 @@ void CPU::reset() {
 	dest_address = 0x0000;
 	cycles = 0;
 
-	IME = false;
+	lazyFlags = {};
+
+#if CPU_BLOCK_CACHE
+	// The cartridge may have been changed
+	if (blockCache) {
+		blockCache->clear();
+	}
+
+	block = nullptr;
+	uop = nullptr;
+#endif
+
+#if CPU_JIT
+	if (recompiler) {
+		recompiler->clear();
+	}
+#endif
+
+#if CPU_IDLE_SKIP
+	idleLoop = {};
+#endif
+
+	isCycling = false;
+	isFetched = false;
+
+	interrupts->setIME(false);
 	isHalt = false;
 	isStop = false;
+	bus->setStopped(false);
 
 	//computeCycles(); // Preparing the number of cycle to wait to execute first instruction
 }
 
-void CPU::clock() {
+template<class Memory>
+void CPU<Memory>::clock() {
 	if (!isCycling) {
 		computeCycles();
 		isCycling = true;
@@ -42,163 +101,1350 @@ void CPU::clock() {
 	}
 
 	if (cycles == 0) {
-		if (!isStop) {
-			if (!isHalt) {
-				if (!handleInterrupt()) {
-					prepInstruction();
+		// A halted CPU only executes an instruction once woken up by handleInterrupt()
+		if (!isStop && !handleInterrupt() && !isHalt) {
+			prepInstruction();
 
-					if (IMEScheduled) { // TODO: consider if need to go in prepinstruction function (to handle hardware bug ?)
-						IMEScheduled = false;
-						IME = true;
-					}
+			if (IMEScheduled) { // TODO: consider if need to go in prepinstruction function (to handle hardware bug ?)
+				IMEScheduled = false;
+				interrupts->setIME(true);
+			}
 
-					opcode = readBus(registers.PC);
-					registers.PC++;
+			execute();
 
-					(this->*instructions[opcode].addrMode)();
-					(this->*instructions[opcode].operate)();
+#if !CPU_LAZY_FLAGS
+			// Always set unused flags to 0
+			setFlag(cpu_flags_t::u, false);
+#endif
 
-					// Always set unused flags to 0
-					setFlag(cpu_flags_t::u, false);
+			isCycling = false;
+		}
+	}
+}
 
-					isCycling = false;
-				}
-			}
-			else {
-				handleInterrupt();
+// Run the CPU up to its next action (an instruction or an interrupt dispatch) and return the number of M-cycles it took
+// Timing is the same as with clock(): the opcode is read on the first M-cycle and the action is done on the last one
+// so the other components are advanced in two goes around it
+// When halted, the M-cycles until the next interrupt request are skipped at once
+template<class Memory>
+uint32_t CPU<Memory>::step() {
+	// Halted with no interrupt pending, nothing happens until the timer requests one
+	if (isHalt && isCycling && !isStop && !canInterrupt(0)) {
+		uint32_t skipped = fastForwardHalt();
+
+		if (skipped) {
+			return skipped;
+		}
+	}
+
+#if CPU_IDLE_SKIP
+	// A backward JR was just taken, its target may be a polling loop
+	if (registers.PC == loopStart && isIdleSkipEnabled && !isCycling && !isHalt && !isStop && !IMEScheduled) {
+		uint32_t skipped = skipIdleLoop();
+
+		if (skipped) {
+			return skipped;
+		}
+	}
+#endif
+
+#if CPU_JIT
+	// Compiled blocks are only run between two instructions
+	if (recompiler && !isCycling && !isHalt && !isStop && !IMEScheduled) {
+		uint8_t elapsed = runCompiled();
+
+		if (elapsed) {
+			return elapsed;
+		}
+	}
+#endif
+
+	uint8_t elapsed = 1;
+
+#if CPU_CYCLE_ACCURATE
+	uint8_t dispatchCycles = cycles;	// M-cycles of an interrupt dispatched by the previous step, they come before the instruction
+	bool isDispatchTicked = false;
+#endif
+
+	bus->advance(1);
+
+	if (!isCycling) {
+		computeCycles();
+		isCycling = true;
+
+#if CPU_FUSION
+		// The opcode at PC is known, the following instructions may be run along with it
+		if (isFusionEnabled && isFusionStart(opcode) && !isHalt && !isStop && !IMEScheduled) {
+			uint8_t fused = runFused();
+
+			if (fused) {
+				return fused;
 			}
 		}
+#endif
+	}
+
+#if CPU_CYCLE_ACCURATE
+	// The M-cycles of the instruction are advanced by its bus accesses
+	// Interrupts are checked once its opcode is fetched: one requested during the instruction is dispatched after it
+	if (!isHalt && !isStop) {
+		bus->advance(dispatchCycles);
+		cyclesToTick = cycles - dispatchCycles - 1;
+		elapsed = cycles;
+
+		// The dispatch replaces the instruction, its first M-cycle was the opcode fetch
+		if (interrupts->getIME() && interrupts->isPending()) {
+			cyclesToTick = 4;
+			elapsed = dispatchCycles + 5;
+			isDispatchTicked = true;
+		}
 	}
+	else
+#endif
+	// When halted, interrupts are checked every M-cycle
+	if (cycles > 1) {
+		bus->advance(cycles - 1);
+		elapsed = cycles;
+	}
+
+	cycles = 0;
+
+	// A halted CPU only executes an instruction once woken up by handleInterrupt()
+	if (!isStop && !handleInterrupt() && !isHalt) {
+		prepInstruction();
+
+		if (IMEScheduled) {
+			IMEScheduled = false;
+			interrupts->setIME(true);
+		}
+
+		execute();
+
+#if !CPU_LAZY_FLAGS
+		// Always set unused flags to 0
+		setFlag(cpu_flags_t::u, false);
+#endif
+
+		isCycling = false;
+	}
+
+#if CPU_CYCLE_ACCURATE
+	// The M-cycles of a dispatch advanced by its bus accesses are not carried over to the next step
+	if (isDispatchTicked) {
+		cycles = 0;
+	}
+
+	// Internal M-cycles following the last bus access
+	if (cyclesToTick) {
+		bus->advance(cyclesToTick);
+		cyclesToTick = 0;
+	}
+#endif
+
+	return elapsed;
 }
 
-uint8_t CPU::getCycles() const {
+template<class Memory>
+uint8_t CPU<Memory>::getCycles() const {
 	return cycles;
 }
 
-void CPU::computeCycles() {
-	uint8_t ref = readBus(registers.PC);
+// Switch between the predecoded blocks cache and reading every instruction from the bus
+template<class Memory>
+void CPU<Memory>::setBlockCache(bool enabled) {
+#if CPU_BLOCK_CACHE
+	// Blocks are keyed by ROM bank, so the cache is only available with a cartridge
+	if constexpr (Memory::hasRom) {
+		if (enabled && !blockCache) {
+			blockCache = new BlockCache(bus);
+		}
+	}
 
-	// Getting the expected number of cycle from instructions table
-	cycles += instructions[ref].cycles;
-
-	// If it's a JP or JR instruction need to add 1 cycle if condition is fullfill
-	if ((ref & 0b11100111) == 0b11000010	 // Mask for JP cc instruction
-	|| (ref & 0b11100111) == 0b00100000) // Mask for JR cc instruction
-	{
-		if (maskCond((ref & 0b00011000) >> 3)) {
-			cycles += 1;
+	if (!enabled && blockCache) {
+		delete blockCache;
+		blockCache = nullptr;
+	}
+
+	block = nullptr;
+	uop = nullptr;
+#endif
+}
+
+// Switch between compiling hot blocks of ROM code and interpreting every instruction
+template<class Memory>
+void CPU<Memory>::setRecompiler(bool enabled) {
+#if CPU_JIT
+	// Only ROM code is compiled, so the recompiler is only available with a cartridge
+	if constexpr (Memory::hasRom) {
+		if (enabled && !recompiler) {
+			recompiler = new Recompiler(bus);
 		}
 	}
-	// If it's a CALL or RET instruction need to add 3 cycles if condition is fullfill
-	else if ((ref & 0b11100111) == 0b11000100	 // Mask for CALL cc instruction
-		 || (ref & 0b11100111) == 0b11000000)
-	{
-		if (maskCond((ref & 0b00011000) >> 3)) {
-			cycles += 3;
+
+	if (!enabled && recompiler) {
+		delete recompiler;
+		recompiler = nullptr;
+	}
+#endif
+}
+
+#if CPU_JIT
+// Run the compiled block at PC if there is one, return its M-cycles (0 if it was left to the interpreter)
+template<class Memory>
+uint8_t CPU<Memory>::runCompiled() {
+	const Recompiler::jit_block_t* compiled = recompiler->lookup(registers.PC);
+
+	if (!compiled) {
+		return 0;
+	}
+
+	// Interrupts are checked before each instruction, so the whole block must run before any can be raised
+	if (canInterrupt(compiled->cycles)) {
+		recompiler->deferred++;
+		return 0;
+	}
+
+	// Compiled code reads and writes F directly
+	syncFlags();
+
+	recompiler->run(compiled, (uint8_t*)&registers);
+
+	registers.PC = compiled->end;
+	instructionCount += compiled->length;
+
+	bus->advance(compiled->cycles);
+
+	return compiled->cycles;
+}
+#endif
+
+// Whether an interrupt is pending or can be requested within the next M-cycles (only the timer requests them on its own)
+template<class Memory>
+bool CPU<Memory>::canInterrupt(uint8_t cycles) {
+	return interrupts->isPending()
+		|| ((interrupts->getEnable() & InterruptController::t) && bus->getCyclesToInterrupt() <= cycles);
+}
+
+// Advance the components of a halted CPU up to the M-cycle requesting the next timer interrupt, return the number of M-cycles skipped
+// The M-cycle requesting it is left to step() so the interrupt is handled as usual
+template<class Memory>
+uint32_t CPU<Memory>::fastForwardHalt() {
+	uint32_t skipped = std::min(bus->getCyclesToInterrupt() - 1, maxSkip);
+
+	bus->fastForward(skipped);
+
+	return skipped;
+}
+
+#if CPU_IDLE_SKIP
+// Skip iterations of the polling loop starting at PC, while the polled value stays the same and no interrupt is requested
+// The last iteration is left to the interpreter so the registers end up as if every iteration was run, return the number of M-cycles skipped
+template<class Memory>
+uint32_t CPU<Memory>::skipIdleLoop() {
+	// Only loops in ROM are analysed, so their code can't change
+	if (!Memory::hasRom || registers.PC > 0x7FFF || canInterrupt(0)) {
+		return 0;
+	}
+
+	uint32_t key = ((uint32_t)bus->getRomBank(registers.PC) << 16) | registers.PC;
+
+	if (key != idleLoop.key) {
+		analyseIdleLoop(key);
+	}
+
+	if (!idleLoop.isIdle) {
+		return 0;
+	}
+
+	uint16_t addr = idleLoop.address;
+
+	switch (idleLoop.load) {
+	case 0x0A: addr = registers.BC.full; break;
+	case 0x1A: addr = registers.DE.full; break;
+	case 0x7E: addr = registers.HL.full; break;
+	case 0xF2: addr = 0xFF00 | registers.BC.lo; break;
+	}
+
+	// Reading has no side effect, the value is the one every skipped iteration and the following one would read
+	uint8_t value = bus->read(addr);
+
+	if (!isIdleLoopTaken(value)) {
+		return 0;
+	}
+
+	// The value of the following iteration has to be read before it can change
+	// and the skipped iterations have to end before the timer requests an interrupt (even if it's not enabled)
+	uint32_t toChange = bus->getCyclesToChange(addr);
+
+	if (toChange <= idleLoop.readCycle) {
+		return 0;
+	}
+
+	uint32_t window = std::min({ toChange - idleLoop.readCycle, bus->getCyclesToInterrupt(), maxSkip + 1 });
+	uint32_t iterations = (window - 1) / idleLoop.cycles;
+
+	if (iterations == 0) {
+		return 0;
+	}
+
+	uint32_t skipped = iterations * idleLoop.cycles;
+
+	bus->fastForward(skipped);
+
+	// A and the flags are left as the last skipped iteration set them
+	registers.AF.hi = value;
+
+	switch (idleLoop.test) {
+	case 0xFE: cp8(idleLoop.operand); break;
+	case 0xE6: and8(idleLoop.operand); break;
+	case 0xF6: or8(idleLoop.operand); break;
+	case 0xA7: and8(value); break;
+	case 0xB7: or8(value); break;
+	case 0xCB: bit8(value, (idleLoop.operand >> 3) & 0b111); break;
+	}
+
+	instructionCount += iterations * idleLoop.length;
+	idleLoopsSkipped++;
+	idleCyclesSkipped += skipped;
+
+	return skipped;
+}
+
+// Check whether the code at PC is a polling loop: a load into A from memory, an optional test of A, and a JR back to the load
+// Every instruction only depends on the polled value and changes only A and the flags
+template<class Memory>
+void CPU<Memory>::analyseIdleLoop(uint32_t key) {
+	idleLoop = {};
+	idleLoop.key = key;
+
+	uint16_t pc = registers.PC;
+	uint8_t op = bus->read(pc);
+
+	switch (op) {
+	case 0xF0:	// LDH A, [n8]
+		idleLoop.address = 0xFF00 | bus->read(pc + 1);
+		pc += 2;
+		break;
+	case 0xFA:	// LD A, [n16]
+		idleLoop.address = bus->read(pc + 1) | (bus->read(pc + 2) << 8);
+		pc += 3;
+		break;
+	case 0x0A: case 0x1A: case 0x7E: case 0xF2:	// LD A, [BC] / [DE] / [HL] / [C]
+		pc += 1;
+		break;
+	default:
+		return;
+	}
+
+	idleLoop.load = op;
+	idleLoop.readCycle = instructions[op].cycles;
+	idleLoop.cycles = instructions[op].cycles;
+	idleLoop.length = 1;
+
+	op = bus->read(pc);
+
+	if (op == 0xFE || op == 0xE6 || op == 0xF6 || op == 0xA7 || op == 0xB7
+		|| (op == 0xCB && (bus->read(pc + 1) & 0xC7) == 0x47)) {	// CP / AND / OR n8, AND A, OR A, BIT b, A
+		idleLoop.test = op;
+		idleLoop.cycles += op == 0xCB ? prefixed[bus->read(pc + 1)].cycles : instructions[op].cycles;
+		idleLoop.length++;
+
+		if (op != 0xA7 && op != 0xB7) {
+			idleLoop.operand = bus->read(pc + 1);
+			pc++;
+		}
+
+		pc++;
+		op = bus->read(pc);
+	}
+
+	// JR or JR cc back to the load, in the same ROM bank
+	if ((op != 0x18 && (op & 0xE7) != 0x20)
+		|| (uint16_t)(pc + 2 + (int8_t)bus->read(pc + 1)) != registers.PC
+		|| ((pc + 1) & 0xC000) != (registers.PC & 0xC000)) {
+		return;
+	}
+
+	idleLoop.jr = op;
+	idleLoop.cycles += op == 0x18 ? instructions[op].cycles : instructions[op].cyclesBranch;
+	idleLoop.length++;
+	idleLoop.isIdle = true;
+}
+
+// Whether an iteration reading the value ends by jumping back to the load
+template<class Memory>
+bool CPU<Memory>::isIdleLoopTaken(uint8_t value) {
+	bool z = getFlag(cpu_flags_t::z);
+	bool c = getFlag(cpu_flags_t::c);
+
+	switch (idleLoop.test) {
+	case 0xFE: z = value == idleLoop.operand; c = value < idleLoop.operand; break;
+	case 0xE6: z = !(value & idleLoop.operand); c = false; break;
+	case 0xF6: z = !(value | idleLoop.operand); c = false; break;
+	case 0xA7: case 0xB7: z = !value; c = false; break;
+	case 0xCB: z = !(value & (1 << ((idleLoop.operand >> 3) & 0b111))); break;
+	}
+
+	switch (idleLoop.jr) {
+	case 0x20: return !z;
+	case 0x28: return z;
+	case 0x30: return !c;
+	case 0x38: return c;
+	}
+
+	return true;
+}
+
+#endif
+
+// Switch between skipping polling loops and running them
+template<class Memory>
+void CPU<Memory>::setIdleSkip(bool enabled) {
+#if CPU_IDLE_SKIP
+	isIdleSkipEnabled = enabled;
+#endif
+}
+
+// Attach debugging callbacks (nullptr to detach them), ignored without DEBUG_HOOKS
+template<class Memory>
+void CPU<Memory>::setDebugHooks([[maybe_unused]] DebugHooks* h) {
+#if DEBUG_HOOKS
+	hooks = h;
+#endif
+}
+
+// Switch between running fused sequences and dispatching every instruction on its own
+template<class Memory>
+void CPU<Memory>::setFusion(bool enabled) {
+#if CPU_FUSION
+	isFusionEnabled = enabled;
+#endif
+}
+
+// Print the number of times each fused sequence was run, and the most frequent opcode pairs
+template<class Memory>
+void CPU<Memory>::dumpFusions(std::ostream& os) const {
+#if CPU_FUSION
+	static constexpr const char* names[(uint8_t)cpu_fusion_t::count] = {
+		"DEC r8 / JR NZ",
+		"CP n8 / JR cc",
+		"LDH A, [n8] / CP or AND n8 / JR cc",
+		"LD A, [HL+] / LD [DE], A / INC DE"
+	};
+
+	os << std::endl << "Fusions:" << std::endl;
+
+	for (uint8_t i = 0; i < (uint8_t)cpu_fusion_t::count; i++) {
+		os << "\t" << names[i] << ":\t" << fusionCount[i] << std::endl;
+	}
+#endif
+
+#if CPU_PAIR_HISTOGRAM
+	std::vector<uint32_t> pairs(0x10000);
+	std::iota(pairs.begin(), pairs.end(), 0);
+	std::partial_sort(pairs.begin(), pairs.begin() + 20, pairs.end(), [this](uint32_t a, uint32_t b) {
+		return pairHistogram[a] > pairHistogram[b];
+	});
+
+	os << std::endl << "Opcode pairs:" << std::endl;
+
+	for (uint8_t i = 0; i < 20 && pairHistogram[pairs[i]]; i++) {
+		uint8_t first = pairs[i] >> 8;
+		uint8_t second = pairs[i] & 0xFF;
+
+		os << "\t" << std::hex << std::uppercase << std::setfill('0') << std::setw(2) << (int)first << " " << std::setw(2) << (int)second
+			<< std::dec << "\t" << instructions[first].name << " / " << instructions[second].name << ":\t" << pairHistogram[pairs[i]] << std::endl;
+	}
+#endif
+}
+
+#if CPU_FUSION
+// Run the instruction at PC along with the following ones if they form a fused sequence, return their M-cycles (0 if not fused)
+// The opcode at PC has been fetched by computeCycles() and the first M-cycle of the instruction is already elapsed
+template<class Memory>
+uint8_t CPU<Memory>::runFused() {
+	cpu_fusion_t fusion;
+	uint8_t maxCycles;
+
+	// Following instructions are read ahead, reading code has no side effect
+	switch (opcode) {
+	case 0x05: case 0x0D: case 0x15: case 0x1D: case 0x25: case 0x2D: case 0x3D:
+		if (bus->read(registers.PC + 1) != 0x20) {
+			return 0;
+		}
+
+		fusion = cpu_fusion_t::decJr;
+		maxCycles = 1 + 3;
+		break;
+	case 0xFE:
+		if (!isJrCond(bus->read(registers.PC + 2))) {
+			return 0;
+		}
+
+		fusion = cpu_fusion_t::cpJr;
+		maxCycles = 2 + 3;
+		break;
+	case 0xF0: {
+		uint8_t alu = bus->read(registers.PC + 2);
+
+		if ((alu != 0xFE && alu != 0xE6) || !isJrCond(bus->read(registers.PC + 4))) {
+			return 0;
+		}
+
+		fusion = cpu_fusion_t::ldhAluJr;
+		maxCycles = 3 + 2 + 3;
+		break;
+	}
+	case 0x2A:
+		if (bus->read(registers.PC + 1) != 0x12 || bus->read(registers.PC + 2) != 0x13) {
+			return 0;
+		}
+
+		fusion = cpu_fusion_t::copy;
+		maxCycles = 2 + 2 + 2;
+		break;
+	default:
+		return 0;
+	}
+
+	// Interrupts are checked before each instruction, none must be requested before the last one
+	if (canInterrupt(maxCycles - 1)) {
+		return 0;
+	}
+
+	cycles = 0;
+	isCycling = false;
+	isFetched = false;
+	instructionCount++;
+
+	uint8_t elapsed = 0;
+
+	switch (fusion) {
+	case cpu_fusion_t::decJr:
+		switch (opcode) {
+		case 0x05: elapsed = fusedDecJr<0x05>(); break;
+		case 0x0D: elapsed = fusedDecJr<0x0D>(); break;
+		case 0x15: elapsed = fusedDecJr<0x15>(); break;
+		case 0x1D: elapsed = fusedDecJr<0x1D>(); break;
+		case 0x25: elapsed = fusedDecJr<0x25>(); break;
+		case 0x2D: elapsed = fusedDecJr<0x2D>(); break;
+		case 0x3D: elapsed = fusedDecJr<0x3D>(); break;
 		}
+		break;
+	case cpu_fusion_t::cpJr:
+		elapsed = fusedCpJr();
+		break;
+	case cpu_fusion_t::ldhAluJr:
+		elapsed = fusedLdhAluJr();
+		break;
+	case cpu_fusion_t::copy:
+		elapsed = fusedCopy();
+		break;
+	default:
+		break;
+	}
+
+	fusionCount[(uint8_t)fusion]++;
+
+	return elapsed;
+}
+
+// Start the next instruction of a fused sequence
+template<class Memory>
+void CPU<Memory>::nextFusedInstruction([[maybe_unused]] uint8_t op) {
+	instructionCount++;
+
+#if CPU_PAIR_HISTOGRAM
+	// Pairs inside fused sequences are only counted in fusionCount
+	previousOpcode = op;
+#endif
+
+#if CPU_BLOCK_CACHE
+	// Operands are read from the bus, and the block goes on after the sequence
+	uop = nullptr;
+
+	if (block) {
+		blockIndex++;
+	}
+#endif
+}
+
+// DEC r8 / JR NZ, e8
+template<class Memory>
+template<uint8_t Op>
+uint8_t CPU<Memory>::fusedDecJr() {
+	registers.PC++;
+	decR8<Op>();
+
+	nextFusedInstruction(0x20);
+	registers.PC++;
+	int8_t e = readPC();
+	uint8_t elapsed = 1 + 2;
+
+	if (!getFlag(cpu_flags_t::z)) {
+		registers.PC += e;
+		elapsed++;
+	}
+
+	// None of the instructions accesses the bus, the other components are advanced at once
+	bus->advance(elapsed - 1);
+
+	return elapsed;
+}
+
+// CP n8 / JR cc, e8
+template<class Memory>
+uint8_t CPU<Memory>::fusedCpJr() {
+	registers.PC++;
+	cp8(readPC());
+
+	uint8_t jr = readBus(registers.PC);
+	nextFusedInstruction(jr);
+	registers.PC++;
+	int8_t e = readPC();
+	uint8_t elapsed = 2 + 2;
+
+	if (maskCond((jr & 0b00011000) >> 3)) {
+		registers.PC += e;
+		elapsed++;
+
+#if CPU_IDLE_SKIP
+		if (e < 0) {
+			loopStart = registers.PC;
+		}
+#endif
+	}
+
+	bus->advance(elapsed - 1);
+
+	return elapsed;
+}
+
+// LDH A, [n8] / CP n8 or AND n8 / JR cc, e8
+template<class Memory>
+uint8_t CPU<Memory>::fusedLdhAluJr() {
+	registers.PC++;
+	uint8_t addr = readPC();
+
+	// The register is read on the last M-cycle of LDH
+	bus->advance(2);
+	registers.AF.hi = readBus(0xFF00 | addr);
+
+	uint8_t alu = readBus(registers.PC);
+	nextFusedInstruction(alu);
+	registers.PC++;
+	uint8_t data = readPC();
+
+	if (alu == 0xFE) {
+		cp8(data);
+	}
+	else {
+		and8(data);
+	}
+
+	uint8_t jr = readBus(registers.PC);
+	nextFusedInstruction(jr);
+	registers.PC++;
+	int8_t e = readPC();
+	uint8_t elapsed = 3 + 2 + 2;
+
+	if (maskCond((jr & 0b00011000) >> 3)) {
+		registers.PC += e;
+		elapsed++;
+
+#if CPU_IDLE_SKIP
+		if (e < 0) {
+			loopStart = registers.PC;
+		}
+#endif
+	}
+
+	bus->advance(elapsed - 3);
+
+	return elapsed;
+}
+
+// LD A, [HL+] / LD [DE], A / INC DE
+template<class Memory>
+uint8_t CPU<Memory>::fusedCopy() {
+	// Memory is accessed on the last M-cycle of each instruction
+	registers.PC++;
+	bus->advance(1);
+	registers.AF.hi = readBus(registers.HL.full++);
+
+	nextFusedInstruction(0x12);
+	registers.PC++;
+	bus->advance(2);
+	writeBus(registers.DE.full, registers.AF.hi);
+
+	// Writes to the cartridge (mapper), to I/O registers (interrupts, timer) or to the code itself end the sequence
+	if (registers.DE.full <= 0x7FFF || registers.DE.full >= 0xFF00 || registers.DE.full == registers.PC) {
+		return 2 + 2;
 	}
+
+	nextFusedInstruction(0x13);
+	registers.PC++;
+	bus->advance(2);
+	registers.DE.full++;
+
+	return 2 + 2 + 2;
+}
+#endif
+
+template<class Memory>
+const char* CPU<Memory>::getDispatchName() {
+#if CPU_SWITCH_DISPATCH
+	return "switch";
+#else
+	return "function pointers table";
+#endif
+}
+
+template<class Memory>
+const char* CPU<Memory>::getTimingName() {
+#if CPU_CYCLE_ACCURATE
+	return "cycle-accurate";
+#else
+	return "instruction-at-once";
+#endif
+}
+
+template<class Memory>
+void CPU<Memory>::computeCycles() {
+	fetch();
+
 	// If it's a prefix instruction, then look cycles from prefixed table
-	else if (ref == 0xCB) {
-		ref = readBus(registers.PC + 1);
-		cycles += prefixed[ref].cycles;
+	if (opcode == 0xCB) {
+#if CPU_BLOCK_CACHE
+		if (uop) {
+			cycles += prefixed[uop->operands[0]].cycles;
+		}
+		else
+#endif
+		cycles += prefixed[readBus(registers.PC + 1)].cycles;
+	}
+	// Conditional JP, JR, CALL and RET take extra cycles if their condition is fulfilled
+	else if (isBranchTaken) {
+		cycles += instructions[opcode].cyclesBranch;
+	}
+	// Getting the expected number of cycle from instructions table
+	else {
+		cycles += instructions[opcode].cycles;
 	}
 }
 
-void CPU::prepInstruction() {
+template<class Memory>
+void CPU<Memory>::prepInstruction() {
 	fetched_data = 0x0000;
 	dest_reg = nullptr;
 	dest_reg16 = nullptr;
 	dest_address = 0x0000;
 
+#if !CPU_LAZY_FLAGS
 	// Always set unused flags to 0
 	// TODO: Consider if required before execution of instruction
 	setFlag(cpu_flags_t::u, false);
+#endif
 }
 
-uint8_t CPU::getFlag(cpu_flags_t f) {
+template<class Memory>
+uint8_t CPU<Memory>::getFlag(cpu_flags_t f) {
+#if CPU_LAZY_FLAGS
+	// Zero and Carry flags (used by conditions) are computed alone without writing F
+	if (lazyFlags.op != cpu_lazy_op_t::none) {
+		if (f == cpu_flags_t::z) return !lazyFlags.result;
+		if (f == cpu_flags_t::c) return lazyCarry();
+
+		syncFlags();
+	}
+#endif
+
 	return (registers.AF.lo & f) > 0 ? 1 : 0;
 }
 
-void CPU::setFlag(cpu_flags_t f, bool v) {
+template<class Memory>
+void CPU<Memory>::setFlag(cpu_flags_t f, bool v) {
+#if CPU_LAZY_FLAGS
+	syncFlags();
+#endif
+
 	if (v)	registers.AF.lo |= f;
 	else	registers.AF.lo &= ~f;
 }
 
-void CPU::setFlags(bool z, bool n, bool h, bool c) {
+template<class Memory>
+void CPU<Memory>::setFlags(bool z, bool n, bool h, bool c) {
+#if CPU_LAZY_FLAGS
+	// Every flag is overwritten so pending ones are dropped
+	// Unused flags are always 0 in this mode (POP AF clears them)
+	lazyFlags.op = cpu_lazy_op_t::none;
+	registers.AF.lo = (z << 7) | (n << 6) | (h << 5) | (c << 4);
+#else
 	setFlag(cpu_flags_t::z, z);
 	setFlag(cpu_flags_t::n, n);
 	setFlag(cpu_flags_t::h, h);
 	setFlag(cpu_flags_t::c, c);
+#endif
+}
+
+// Record an ALU operation, its flags are computed by syncFlags() when F is read
+template<class Memory>
+void CPU<Memory>::recordFlags(cpu_lazy_op_t op, uint16_t a, uint16_t b, uint8_t c, uint8_t result) {
+	lazyFlags.op = op;
+	lazyFlags.a = a;
+	lazyFlags.b = b;
+	lazyFlags.c = c;
+	lazyFlags.result = result;
+}
+
+// Carry flag of the pending operation
+template<class Memory>
+uint8_t CPU<Memory>::lazyCarry() const {
+	switch (lazyFlags.op) {
+	case cpu_lazy_op_t::add:
+	case cpu_lazy_op_t::adc:
+		return lazyFlags.a + lazyFlags.b + lazyFlags.c > 0xFF;
+	case cpu_lazy_op_t::sub:
+	case cpu_lazy_op_t::sbc:
+	case cpu_lazy_op_t::cp:
+		return lazyFlags.a < lazyFlags.b + lazyFlags.c;
+	case cpu_lazy_op_t::bitAnd:
+	case cpu_lazy_op_t::bitOr:
+		return 0;
+	case cpu_lazy_op_t::add16:
+		return lazyFlags.a + lazyFlags.b > 0xFFFF;
+	case cpu_lazy_op_t::inc:
+	case cpu_lazy_op_t::dec:
+	case cpu_lazy_op_t::shift:
+	case cpu_lazy_op_t::bit:
+		return lazyFlags.c;
+	case cpu_lazy_op_t::none:
+		break;
+	}
+
+	return (registers.AF.lo & cpu_flags_t::c) > 0 ? 1 : 0;
+}
+
+// Compute the pending flags and write them to F
+template<class Memory>
+void CPU<Memory>::syncFlags() {
+#if CPU_LAZY_FLAGS
+	bool n = false;
+	bool h = false;
+
+	switch (lazyFlags.op) {
+	case cpu_lazy_op_t::none:
+		return;
+	case cpu_lazy_op_t::add:
+	case cpu_lazy_op_t::adc:
+		h = (lazyFlags.a & 0xF) + (lazyFlags.b & 0xF) + lazyFlags.c > 0xF;
+		break;
+	case cpu_lazy_op_t::sub:
+	case cpu_lazy_op_t::sbc:
+	case cpu_lazy_op_t::cp:
+		n = true;
+		h = (lazyFlags.a & 0xF) < (lazyFlags.b & 0xF) + lazyFlags.c;
+		break;
+	case cpu_lazy_op_t::bitAnd:
+	case cpu_lazy_op_t::bit:
+		h = true;
+		break;
+	case cpu_lazy_op_t::inc:
+		h = (lazyFlags.a & 0xF) == 0xF;
+		break;
+	case cpu_lazy_op_t::dec:
+		n = true;
+		h = (lazyFlags.a & 0xF) == 0x0;
+		break;
+	case cpu_lazy_op_t::add16:
+		h = (lazyFlags.a & 0xFFF) + (lazyFlags.b & 0xFFF) > 0xFFF;
+		break;
+	case cpu_lazy_op_t::bitOr:
+	case cpu_lazy_op_t::shift:
+		break;
+	}
+
+	setFlags(!lazyFlags.result, n, h, lazyCarry());
+#endif
+}
+
+// Read the opcode pointed by PC and evaluate its condition once, for both cycles computation and execution
+template<class Memory>
+void CPU<Memory>::fetch() {
+#if CPU_BLOCK_CACHE
+	if (blockCache) {
+		// Following instruction of the current block, or else the block starting at PC
+		if (block && blockIndex < block->uops.size() && block->uops[blockIndex].pc == registers.PC) {
+			uop = &block->uops[blockIndex];
+		}
+		else {
+			block = blockCache->lookup(registers.PC);
+			blockIndex = 0;
+			uop = block ? &block->uops[0] : nullptr;
+		}
+
+		if (uop) {
+			blockIndex++;
+			opcode = uop->opcode;
+		}
+		else {
+			opcode = readBus(registers.PC);
+		}
+	}
+	else
+#endif
+	opcode = readBus(registers.PC);
+
+	isBranchTaken = instructions[opcode].cyclesBranch && maskCond((opcode & 0b00011000) >> 3);
+	isFetched = true;
 }
 
-uint8_t CPU::readBus(uint16_t addr) {
+// Execute the instruction pointed by PC (fetching it if it has not been done yet)
+template<class Memory>
+void CPU<Memory>::execute() {
+	if (!isFetched) {
+		fetch();
+	}
+
+	isFetched = false;
+
+#if DEBUG_HOOKS
+	uint16_t pc = registers.PC;
+	uint8_t op = opcode;
+
+	if (hooks && hooks->onExecute) {
+		hooks->onExecute(hooks->context, pc, op);
+	}
+#endif
+
+	registers.PC++;
+
+	instructionCount++;
+
+#if CPU_PAIR_HISTOGRAM
+	pairHistogram[(previousOpcode << 8) | opcode]++;
+	previousOpcode = opcode;
+#endif
+
+#if CPU_SWITCH_DISPATCH
+	#define CASE(op, handler) case op: handler<op>(); break;
+	#define CASE_CB(op, handler) case 0x100 | op: handler<op>(); break;
+
+	// Prefixed instructions are dispatched in the same switch, at index 0x100 + opcode
+	uint16_t index = opcode;
+
+	if (opcode == 0xCB) {
+		opcode = readPC();
+
+		index = 0x100 | opcode;
+	}
+
+	// Each case calls directly its handler so it can be inlined
+	// Handlers templated on the opcode decode their operands at compile time
+	switch (index) {
+	// NOP
+	case 0x00:
+		NOP();
+		break;
+
+	// LD r16, n16
+	CASE(0x01, ldR16) CASE(0x11, ldR16) CASE(0x21, ldR16) CASE(0x31, ldR16)
+
+	// LD [r16], A
+	case 0x02: case 0x12: case 0x22: case 0x32:
+		IAR(); LD8();
+		break;
+
+	// INC r16 / DEC r16
+	CASE(0x03, incR16) CASE(0x13, incR16) CASE(0x23, incR16) CASE(0x33, incR16)
+	CASE(0x0B, decR16) CASE(0x1B, decR16) CASE(0x2B, decR16) CASE(0x3B, decR16)
+
+	// INC r8 / INC [HL]
+	CASE(0x04, incR8) CASE(0x0C, incR8) CASE(0x14, incR8) CASE(0x1C, incR8) CASE(0x24, incR8) CASE(0x2C, incR8) CASE(0x34, incR8) CASE(0x3C, incR8)
+
+	// DEC r8 / DEC [HL]
+	CASE(0x05, decR8) CASE(0x0D, decR8) CASE(0x15, decR8) CASE(0x1D, decR8) CASE(0x25, decR8) CASE(0x2D, decR8) CASE(0x35, decR8) CASE(0x3D, decR8)
+
+	// LD r8, n8 / LD [HL], n8
+	CASE(0x06, ldR8N8) CASE(0x0E, ldR8N8) CASE(0x16, ldR8N8) CASE(0x1E, ldR8N8) CASE(0x26, ldR8N8) CASE(0x2E, ldR8N8) CASE(0x36, ldR8N8) CASE(0x3E, ldR8N8)
+
+	// ADD HL, r16
+	CASE(0x09, addHL) CASE(0x19, addHL) CASE(0x29, addHL) CASE(0x39, addHL)
+
+	// RLCA
+	case 0x07:
+		REG(); RLCA();
+		break;
+
+	// LD [n16], SP
+	case 0x08:
+		SAB(); LDS();
+		break;
+
+	// LD A, [r16]
+	case 0x0A: case 0x1A: case 0x2A: case 0x3A:
+		IRA(); LD8();
+		break;
+
+	// RRCA
+	case 0x0F:
+		REG(); RRCA();
+		break;
+
+	// STOP
+	case 0x10:
+		IMM(); STP();
+		break;
+
+	// RLA
+	case 0x17:
+		REG(); RLA();
+		break;
+
+	// JR e8
+	case 0x18:
+		IMM(); _JR();
+		break;
+
+	// RRA
+	case 0x1F:
+		REG(); RRA();
+		break;
+
+	// JR cc, e8
+	case 0x20: case 0x28: case 0x30: case 0x38:
+		IMM(); JRC();
+		break;
+
+	// DAA
+	case 0x27:
+		DAA();
+		break;
+
+	// CPL
+	case 0x2F:
+		CPL();
+		break;
+
+	// SCF
+	case 0x37:
+		SCF();
+		break;
+
+	// CCF
+	case 0x3F:
+		CCF();
+		break;
+
+	// LD r8, r8' / LD r8, [HL] / LD [HL], r8
+	CASE(0x40, ldR8) CASE(0x41, ldR8) CASE(0x42, ldR8) CASE(0x43, ldR8) CASE(0x44, ldR8) CASE(0x45, ldR8) CASE(0x46, ldR8) CASE(0x47, ldR8)
+	CASE(0x48, ldR8) CASE(0x49, ldR8) CASE(0x4A, ldR8) CASE(0x4B, ldR8) CASE(0x4C, ldR8) CASE(0x4D, ldR8) CASE(0x4E, ldR8) CASE(0x4F, ldR8)
+	CASE(0x50, ldR8) CASE(0x51, ldR8) CASE(0x52, ldR8) CASE(0x53, ldR8) CASE(0x54, ldR8) CASE(0x55, ldR8) CASE(0x56, ldR8) CASE(0x57, ldR8)
+	CASE(0x58, ldR8) CASE(0x59, ldR8) CASE(0x5A, ldR8) CASE(0x5B, ldR8) CASE(0x5C, ldR8) CASE(0x5D, ldR8) CASE(0x5E, ldR8) CASE(0x5F, ldR8)
+	CASE(0x60, ldR8) CASE(0x61, ldR8) CASE(0x62, ldR8) CASE(0x63, ldR8) CASE(0x64, ldR8) CASE(0x65, ldR8) CASE(0x66, ldR8) CASE(0x67, ldR8)
+	CASE(0x68, ldR8) CASE(0x69, ldR8) CASE(0x6A, ldR8) CASE(0x6B, ldR8) CASE(0x6C, ldR8) CASE(0x6D, ldR8) CASE(0x6E, ldR8) CASE(0x6F, ldR8)
+	CASE(0x70, ldR8) CASE(0x71, ldR8) CASE(0x72, ldR8) CASE(0x73, ldR8) CASE(0x74, ldR8) CASE(0x75, ldR8) CASE(0x77, ldR8)
+	CASE(0x78, ldR8) CASE(0x79, ldR8) CASE(0x7A, ldR8) CASE(0x7B, ldR8) CASE(0x7C, ldR8) CASE(0x7D, ldR8) CASE(0x7E, ldR8) CASE(0x7F, ldR8)
+
+	// HALT
+	case 0x76:
+		HLT();
+		break;
+
+	// ADD, ADC, SUB, SBC, AND, XOR, OR, CP A, r8 / A, [HL]
+	CASE(0x80, aluR8) CASE(0x81, aluR8) CASE(0x82, aluR8) CASE(0x83, aluR8) CASE(0x84, aluR8) CASE(0x85, aluR8) CASE(0x86, aluR8) CASE(0x87, aluR8)
+	CASE(0x88, aluR8) CASE(0x89, aluR8) CASE(0x8A, aluR8) CASE(0x8B, aluR8) CASE(0x8C, aluR8) CASE(0x8D, aluR8) CASE(0x8E, aluR8) CASE(0x8F, aluR8)
+	CASE(0x90, aluR8) CASE(0x91, aluR8) CASE(0x92, aluR8) CASE(0x93, aluR8) CASE(0x94, aluR8) CASE(0x95, aluR8) CASE(0x96, aluR8) CASE(0x97, aluR8)
+	CASE(0x98, aluR8) CASE(0x99, aluR8) CASE(0x9A, aluR8) CASE(0x9B, aluR8) CASE(0x9C, aluR8) CASE(0x9D, aluR8) CASE(0x9E, aluR8) CASE(0x9F, aluR8)
+	CASE(0xA0, aluR8) CASE(0xA1, aluR8) CASE(0xA2, aluR8) CASE(0xA3, aluR8) CASE(0xA4, aluR8) CASE(0xA5, aluR8) CASE(0xA6, aluR8) CASE(0xA7, aluR8)
+	CASE(0xA8, aluR8) CASE(0xA9, aluR8) CASE(0xAA, aluR8) CASE(0xAB, aluR8) CASE(0xAC, aluR8) CASE(0xAD, aluR8) CASE(0xAE, aluR8) CASE(0xAF, aluR8)
+	CASE(0xB0, aluR8) CASE(0xB1, aluR8) CASE(0xB2, aluR8) CASE(0xB3, aluR8) CASE(0xB4, aluR8) CASE(0xB5, aluR8) CASE(0xB6, aluR8) CASE(0xB7, aluR8)
+	CASE(0xB8, aluR8) CASE(0xB9, aluR8) CASE(0xBA, aluR8) CASE(0xBB, aluR8) CASE(0xBC, aluR8) CASE(0xBD, aluR8) CASE(0xBE, aluR8) CASE(0xBF, aluR8)
+
+	// ADD, ADC, SUB, SBC, AND, XOR, OR, CP A, n8
+	CASE(0xC6, aluN8) CASE(0xCE, aluN8) CASE(0xD6, aluN8) CASE(0xDE, aluN8) CASE(0xE6, aluN8) CASE(0xEE, aluN8) CASE(0xF6, aluN8) CASE(0xFE, aluN8)
+
+	// RET cc
+	case 0xC0: case 0xC8: case 0xD0: case 0xD8:
+		REC();
+		break;
+
+	// POP r16
+	case 0xC1: case 0xD1: case 0xE1: case 0xF1:
+		STR(); POP();
+		break;
+
+	// JP cc, n16
+	case 0xC2: case 0xCA: case 0xD2: case 0xDA:
+		IM6(); JPC();
+		break;
+
+	// JP n16
+	case 0xC3:
+		IM6(); _JP();
+		break;
+
+	// CALL cc, n16
+	case 0xC4: case 0xCC: case 0xD4: case 0xDC:
+		IM6(); CLC();
+		break;
+
+	// PUSH r16
+	case 0xC5: case 0xD5: case 0xE5: case 0xF5:
+		RTS(); PSH();
+		break;
+
+	// RST vec
+	case 0xC7: case 0xCF: case 0xD7: case 0xDF: case 0xE7: case 0xEF: case 0xF7: case 0xFF:
+		RST();
+		break;
+
+	// RET
+	case 0xC9:
+		RET();
+		break;
+
+	// CALL n16
+	case 0xCD:
+		IM6(); CLL();
+		break;
+
+	// Illegal opcodes
+	case 0xD3: case 0xDB: case 0xDD: case 0xE3: case 0xE4: case 0xEB: case 0xEC: case 0xED:
+	case 0xF4: case 0xFC: case 0xFD:
+		ILL();
+		break;
+
+	// RETI
+	case 0xD9:
+		REI();
+		break;
+
+	// LDH [n8], A
+	case 0xE0:
+		AA8(); LD8();
+		break;
+
+	// LDH [C], A
+	case 0xE2:
+		IAC(); LD8();
+		break;
+
+	// ADD SP, e8
+	case 0xE8:
+		IMM(); ASP();
+		break;
+
+	// JP HL
+	case 0xE9:
+		JPH();
+		break;
+
+	// LD [n16], A
+	case 0xEA:
+		AAB(); LD8();
+		break;
+
+	// LDH A, [n8]
+	case 0xF0:
+		A8A(); LD8();
+		break;
+
+	// LDH A, [C]
+	case 0xF2:
+		ICA(); LD8();
+		break;
+
+	// DI
+	case 0xF3:
+		_DI();
+		break;
+
+	// LD HL, SP+e8
+	case 0xF8:
+		STH(); LHS();
+		break;
+
+	// LD SP, HL
+	case 0xF9:
+		HTS(); L16();
+		break;
+
+	// LD A, [n16]
+	case 0xFA:
+		ABA(); LD8();
+		break;
+
+	// EI
+	case 0xFB:
+		_EI();
+		break;
+
+	// Prefixed: RLC, RRC, RL, RR, SLA, SRA, SWAP, SRL, BIT, RES and SET r8 / [HL]
+	CASE_CB(0x00, prefixedOp) CASE_CB(0x01, prefixedOp) CASE_CB(0x02, prefixedOp) CASE_CB(0x03, prefixedOp) CASE_CB(0x04, prefixedOp) CASE_CB(0x05, prefixedOp) CASE_CB(0x06, prefixedOp) CASE_CB(0x07, prefixedOp)
+	CASE_CB(0x08, prefixedOp) CASE_CB(0x09, prefixedOp) CASE_CB(0x0A, prefixedOp) CASE_CB(0x0B, prefixedOp) CASE_CB(0x0C, prefixedOp) CASE_CB(0x0D, prefixedOp) CASE_CB(0x0E, prefixedOp) CASE_CB(0x0F, prefixedOp)
+	CASE_CB(0x10, prefixedOp) CASE_CB(0x11, prefixedOp) CASE_CB(0x12, prefixedOp) CASE_CB(0x13, prefixedOp) CASE_CB(0x14, prefixedOp) CASE_CB(0x15, prefixedOp) CASE_CB(0x16, prefixedOp) CASE_CB(0x17, prefixedOp)
+	CASE_CB(0x18, prefixedOp) CASE_CB(0x19, prefixedOp) CASE_CB(0x1A, prefixedOp) CASE_CB(0x1B, prefixedOp) CASE_CB(0x1C, prefixedOp) CASE_CB(0x1D, prefixedOp) CASE_CB(0x1E, prefixedOp) CASE_CB(0x1F, prefixedOp)
+	CASE_CB(0x20, prefixedOp) CASE_CB(0x21, prefixedOp) CASE_CB(0x22, prefixedOp) CASE_CB(0x23, prefixedOp) CASE_CB(0x24, prefixedOp) CASE_CB(0x25, prefixedOp) CASE_CB(0x26, prefixedOp) CASE_CB(0x27, prefixedOp)
+	CASE_CB(0x28, prefixedOp) CASE_CB(0x29, prefixedOp) CASE_CB(0x2A, prefixedOp) CASE_CB(0x2B, prefixedOp) CASE_CB(0x2C, prefixedOp) CASE_CB(0x2D, prefixedOp) CASE_CB(0x2E, prefixedOp) CASE_CB(0x2F, prefixedOp)
+	CASE_CB(0x30, prefixedOp) CASE_CB(0x31, prefixedOp) CASE_CB(0x32, prefixedOp) CASE_CB(0x33, prefixedOp) CASE_CB(0x34, prefixedOp) CASE_CB(0x35, prefixedOp) CASE_CB(0x36, prefixedOp) CASE_CB(0x37, prefixedOp)
+	CASE_CB(0x38, prefixedOp) CASE_CB(0x39, prefixedOp) CASE_CB(0x3A, prefixedOp) CASE_CB(0x3B, prefixedOp) CASE_CB(0x3C, prefixedOp) CASE_CB(0x3D, prefixedOp) CASE_CB(0x3E, prefixedOp) CASE_CB(0x3F, prefixedOp)
+	CASE_CB(0x40, prefixedOp) CASE_CB(0x41, prefixedOp) CASE_CB(0x42, prefixedOp) CASE_CB(0x43, prefixedOp) CASE_CB(0x44, prefixedOp) CASE_CB(0x45, prefixedOp) CASE_CB(0x46, prefixedOp) CASE_CB(0x47, prefixedOp)
+	CASE_CB(0x48, prefixedOp) CASE_CB(0x49, prefixedOp) CASE_CB(0x4A, prefixedOp) CASE_CB(0x4B, prefixedOp) CASE_CB(0x4C, prefixedOp) CASE_CB(0x4D, prefixedOp) CASE_CB(0x4E, prefixedOp) CASE_CB(0x4F, prefixedOp)
+	CASE_CB(0x50, prefixedOp) CASE_CB(0x51, prefixedOp) CASE_CB(0x52, prefixedOp) CASE_CB(0x53, prefixedOp) CASE_CB(0x54, prefixedOp) CASE_CB(0x55, prefixedOp) CASE_CB(0x56, prefixedOp) CASE_CB(0x57, prefixedOp)
+	CASE_CB(0x58, prefixedOp) CASE_CB(0x59, prefixedOp) CASE_CB(0x5A, prefixedOp) CASE_CB(0x5B, prefixedOp) CASE_CB(0x5C, prefixedOp) CASE_CB(0x5D, prefixedOp) CASE_CB(0x5E, prefixedOp) CASE_CB(0x5F, prefixedOp)
+	CASE_CB(0x60, prefixedOp) CASE_CB(0x61, prefixedOp) CASE_CB(0x62, prefixedOp) CASE_CB(0x63, prefixedOp) CASE_CB(0x64, prefixedOp) CASE_CB(0x65, prefixedOp) CASE_CB(0x66, prefixedOp) CASE_CB(0x67, prefixedOp)
+	CASE_CB(0x68, prefixedOp) CASE_CB(0x69, prefixedOp) CASE_CB(0x6A, prefixedOp) CASE_CB(0x6B, prefixedOp) CASE_CB(0x6C, prefixedOp) CASE_CB(0x6D, prefixedOp) CASE_CB(0x6E, prefixedOp) CASE_CB(0x6F, prefixedOp)
+	CASE_CB(0x70, prefixedOp) CASE_CB(0x71, prefixedOp) CASE_CB(0x72, prefixedOp) CASE_CB(0x73, prefixedOp) CASE_CB(0x74, prefixedOp) CASE_CB(0x75, prefixedOp) CASE_CB(0x76, prefixedOp) CASE_CB(0x77, prefixedOp)
+	CASE_CB(0x78, prefixedOp) CASE_CB(0x79, prefixedOp) CASE_CB(0x7A, prefixedOp) CASE_CB(0x7B, prefixedOp) CASE_CB(0x7C, prefixedOp) CASE_CB(0x7D, prefixedOp) CASE_CB(0x7E, prefixedOp) CASE_CB(0x7F, prefixedOp)
+	CASE_CB(0x80, prefixedOp) CASE_CB(0x81, prefixedOp) CASE_CB(0x82, prefixedOp) CASE_CB(0x83, prefixedOp) CASE_CB(0x84, prefixedOp) CASE_CB(0x85, prefixedOp) CASE_CB(0x86, prefixedOp) CASE_CB(0x87, prefixedOp)
+	CASE_CB(0x88, prefixedOp) CASE_CB(0x89, prefixedOp) CASE_CB(0x8A, prefixedOp) CASE_CB(0x8B, prefixedOp) CASE_CB(0x8C, prefixedOp) CASE_CB(0x8D, prefixedOp) CASE_CB(0x8E, prefixedOp) CASE_CB(0x8F, prefixedOp)
+	CASE_CB(0x90, prefixedOp) CASE_CB(0x91, prefixedOp) CASE_CB(0x92, prefixedOp) CASE_CB(0x93, prefixedOp) CASE_CB(0x94, prefixedOp) CASE_CB(0x95, prefixedOp) CASE_CB(0x96, prefixedOp) CASE_CB(0x97, prefixedOp)
+	CASE_CB(0x98, prefixedOp) CASE_CB(0x99, prefixedOp) CASE_CB(0x9A, prefixedOp) CASE_CB(0x9B, prefixedOp) CASE_CB(0x9C, prefixedOp) CASE_CB(0x9D, prefixedOp) CASE_CB(0x9E, prefixedOp) CASE_CB(0x9F, prefixedOp)
+	CASE_CB(0xA0, prefixedOp) CASE_CB(0xA1, prefixedOp) CASE_CB(0xA2, prefixedOp) CASE_CB(0xA3, prefixedOp) CASE_CB(0xA4, prefixedOp) CASE_CB(0xA5, prefixedOp) CASE_CB(0xA6, prefixedOp) CASE_CB(0xA7, prefixedOp)
+	CASE_CB(0xA8, prefixedOp) CASE_CB(0xA9, prefixedOp) CASE_CB(0xAA, prefixedOp) CASE_CB(0xAB, prefixedOp) CASE_CB(0xAC, prefixedOp) CASE_CB(0xAD, prefixedOp) CASE_CB(0xAE, prefixedOp) CASE_CB(0xAF, prefixedOp)
+	CASE_CB(0xB0, prefixedOp) CASE_CB(0xB1, prefixedOp) CASE_CB(0xB2, prefixedOp) CASE_CB(0xB3, prefixedOp) CASE_CB(0xB4, prefixedOp) CASE_CB(0xB5, prefixedOp) CASE_CB(0xB6, prefixedOp) CASE_CB(0xB7, prefixedOp)
+	CASE_CB(0xB8, prefixedOp) CASE_CB(0xB9, prefixedOp) CASE_CB(0xBA, prefixedOp) CASE_CB(0xBB, prefixedOp) CASE_CB(0xBC, prefixedOp) CASE_CB(0xBD, prefixedOp) CASE_CB(0xBE, prefixedOp) CASE_CB(0xBF, prefixedOp)
+	CASE_CB(0xC0, prefixedOp) CASE_CB(0xC1, prefixedOp) CASE_CB(0xC2, prefixedOp) CASE_CB(0xC3, prefixedOp) CASE_CB(0xC4, prefixedOp) CASE_CB(0xC5, prefixedOp) CASE_CB(0xC6, prefixedOp) CASE_CB(0xC7, prefixedOp)
+	CASE_CB(0xC8, prefixedOp) CASE_CB(0xC9, prefixedOp) CASE_CB(0xCA, prefixedOp) CASE_CB(0xCB, prefixedOp) CASE_CB(0xCC, prefixedOp) CASE_CB(0xCD, prefixedOp) CASE_CB(0xCE, prefixedOp) CASE_CB(0xCF, prefixedOp)
+	CASE_CB(0xD0, prefixedOp) CASE_CB(0xD1, prefixedOp) CASE_CB(0xD2, prefixedOp) CASE_CB(0xD3, prefixedOp) CASE_CB(0xD4, prefixedOp) CASE_CB(0xD5, prefixedOp) CASE_CB(0xD6, prefixedOp) CASE_CB(0xD7, prefixedOp)
+	CASE_CB(0xD8, prefixedOp) CASE_CB(0xD9, prefixedOp) CASE_CB(0xDA, prefixedOp) CASE_CB(0xDB, prefixedOp) CASE_CB(0xDC, prefixedOp) CASE_CB(0xDD, prefixedOp) CASE_CB(0xDE, prefixedOp) CASE_CB(0xDF, prefixedOp)
+	CASE_CB(0xE0, prefixedOp) CASE_CB(0xE1, prefixedOp) CASE_CB(0xE2, prefixedOp) CASE_CB(0xE3, prefixedOp) CASE_CB(0xE4, prefixedOp) CASE_CB(0xE5, prefixedOp) CASE_CB(0xE6, prefixedOp) CASE_CB(0xE7, prefixedOp)
+	CASE_CB(0xE8, prefixedOp) CASE_CB(0xE9, prefixedOp) CASE_CB(0xEA, prefixedOp) CASE_CB(0xEB, prefixedOp) CASE_CB(0xEC, prefixedOp) CASE_CB(0xED, prefixedOp) CASE_CB(0xEE, prefixedOp) CASE_CB(0xEF, prefixedOp)
+	CASE_CB(0xF0, prefixedOp) CASE_CB(0xF1, prefixedOp) CASE_CB(0xF2, prefixedOp) CASE_CB(0xF3, prefixedOp) CASE_CB(0xF4, prefixedOp) CASE_CB(0xF5, prefixedOp) CASE_CB(0xF6, prefixedOp) CASE_CB(0xF7, prefixedOp)
+	CASE_CB(0xF8, prefixedOp) CASE_CB(0xF9, prefixedOp) CASE_CB(0xFA, prefixedOp) CASE_CB(0xFB, prefixedOp) CASE_CB(0xFC, prefixedOp) CASE_CB(0xFD, prefixedOp) CASE_CB(0xFE, prefixedOp) CASE_CB(0xFF, prefixedOp)
+	}
+
+	#undef CASE
+	#undef CASE_CB
+#else
+	(this->*instructions[opcode].addrMode)();
+	(this->*instructions[opcode].operate)();
+#endif
+
+#if DEBUG_HOOKS
+	if (hooks && hooks->onRetire) {
+		hooks->onRetire(hooks->context, pc, op);
+	}
+#endif
+}
+
+// Advance the other components by the M-cycle of a bus access or an internal delay of the instruction being executed
+// Only used by step() when CPU_CYCLE_ACCURATE is set, otherwise the M-cycles are already advanced
+// This is where an instruction written as a coroutine would suspend. The CPU drives the clock and nothing else runs between
+// two of its M-cycles but the components advanced here, so advancing them in place gives the same order of accesses
+// without a coroutine frame per instruction or a second copy of every handler
+template<class Memory>
+void CPU<Memory>::tick() {
+#if CPU_CYCLE_ACCURATE
+	if (cyclesToTick) {
+		bus->advance(1);
+		cyclesToTick--;
+	}
+#endif
+}
+
+template<class Memory>
+uint8_t CPU<Memory>::readBus(uint16_t addr) {
+	tick();
+
+#if DEBUG_HOOKS
+	if (hooks && hooks->onRead) {
+		uint8_t data = bus->read(addr);
+		hooks->onRead(hooks->context, addr, data);
+		return data;
+	}
+#endif
+
 	return bus->read(addr);
 }
 
-void CPU::writeBus(uint16_t addr, uint8_t data) {
+template<class Memory>
+void CPU<Memory>::writeBus(uint16_t addr, uint8_t data) {
+	tick();
+
+#if DEBUG_HOOKS
+	if (hooks && hooks->onWrite) {
+		hooks->onWrite(hooks->context, addr, data);
+	}
+#endif
+
 	bus->write(addr, data);
-}
 
-//TODO: Refactor this function
-bool CPU::handleInterrupt() {
-	// Interrupts are handle only if IME is set
-	if (IME) {
-		// Going through each interrupt flags by priority order (from lsb to msb)
-		for (int i = 0; i < 4; i++) {
-			// Interrupt is services only if the Interrupt Enable bit and Interrupt Flag are set
-			if ((bus->getInterruptFlags() & (1 << i)) & (bus->getInterruptEnable() & (1 << i))) {
-				isHalt = false; // If CPU was halt, it starts back
-				bus->clearInterruptFlag(1 << i); // Resetting the handled flag
-				IME = 0; // When interrupt is handle, IME flag is set to 0 so no other interrupt take over (unless IME flag is manually set back)
+#if CPU_BLOCK_CACHE
+	// Writing to the cartridge ROM may switch banks and writing to RAM may modify cached code
+	// Either way the current block is left and the rest of the instruction reads the bus
+	if (blockCache && (addr <= 0x7FFF || blockCache->invalidate(addr))) {
+		block = nullptr;
+		uop = nullptr;
+	}
+#endif
+}
 
-				prepInstruction();
+// Read the byte pointed by PC and move PC to the next one
+template<class Memory>
+uint8_t CPU<Memory>::readPC() {
+	uint8_t data;
 
-				opcode = 0xCD; // Setting the CPU in state like it handle a "call function"
+#if CPU_BLOCK_CACHE
+	if (uop) {
+		tick();
+		data = uop->operands[registers.PC - uop->pc - 1];
+	}
+	else
+#endif
+	data = readBus(registers.PC);
 
-				cycles += 5; // Handling an interrupt takes 5 M-Cycle	//TODO: Move to computeCycles
+	registers.PC++;
 
-				// Defining the address to jump to for the interrupt
-				// It depends of which interrupt is handled
-				// Possible addresses are 0x40, 0x48, 0x50, 0x58 and 0x60
-				fetched_data = 0x40 + (i << 3);	
-				(this->*instructions[opcode].operate)();
+	return data;
+}
 
-				// Always set unused flags to 0
-				setFlag(cpu_flags_t::u, false);
+// Dispatch the highest priority pending interrupt if IME is set, return true if one was dispatched
+// A pending interrupt wakes up a halted CPU even if IME is reset, the CPU then goes on with the instruction following HALT
+template<class Memory>
+bool CPU<Memory>::handleInterrupt() {
+	if (!interrupts->isPending()) {
+		return false;
+	}
 
-				isCycling = false;
+	isHalt = false; // If CPU was halt, it starts back
 
-				return true;
-			}
-		}
+	if (!interrupts->getIME()) {
+		return false;
 	}
-	else {
-		// Going through each interrupt flags by priority order (from lsb to msb)
-		for (int i = 0; i < 4; i++) {
-			// Interrupt is services only if the Interrupt Enable bit and Interrupt Flag are set
-			if ((bus->getInterruptFlags() & (1 << i)) & (bus->getInterruptEnable() & (1 << i))) {
-				prepInstruction();
 
-				if (IMEScheduled) { // TODO: consider if need to go in prepinstruction function (to handle hardware bug ?)
-					IMEScheduled = false;
-					IME = true;
-				}
+	InterruptController::interrupt_source_t source = interrupts->getNext();
 
-				opcode = readBus(registers.PC);
-				registers.PC++;
+	isFetched = false; // Instruction fetched at PC is not executed
+	interrupts->acknowledge(source); // Resetting the handled flag and IME
 
-				(this->*instructions[opcode].addrMode)();
-				(this->*instructions[opcode].operate)();
+	prepInstruction();
 
-				// Always set unused flags to 0
-				setFlag(cpu_flags_t::u, false);
+	opcode = 0xCD; // Setting the CPU in state like it handle a "call function"
 
-				isCycling = false;
-			}
-		}
+	cycles += 5; // Handling an interrupt takes 5 M-Cycle	//TODO: Move to computeCycles
+
+	// Defining the address to jump to for the interrupt
+	// Possible addresses are 0x40, 0x48, 0x50, 0x58 and 0x60
+	fetched_data = InterruptController::getVector(source);
+
+#if DEBUG_HOOKS
+	if (hooks && hooks->onInterrupt) {
+		hooks->onInterrupt(hooks->context, source, fetched_data);
 	}
+#endif
 
-	return false;
+	(this->*instructions[opcode].operate)();
+
+#if !CPU_LAZY_FLAGS
+	// Always set unused flags to 0
+	setFlag(cpu_flags_t::u, false);
+#endif
+
+	isCycling = false;
+
+	return true;
 }
 
 /// ////////////////////// ///
@@ -206,155 +1452,167 @@ bool CPU::handleInterrupt() {
 /// ////////////////////// ///
 
 // Imediate
-void CPU::IMP() {
+template<class Memory>
+void CPU<Memory>::IMP() {
 	return;
 }
 
 // Register to Register
-void CPU::RTR() {
+template<class Memory>
+void CPU<Memory>::RTR() {
 	fetched_data = *maskR8(opcode & 0b00000111);
 	dest_reg = maskR8((opcode & 0b00111000) >> 3);
 }
 
 // [HL] to Register
-void CPU::HLR() {
+template<class Memory>
+void CPU<Memory>::HLR() {
 	fetched_data = readBus(registers.HL.full);
 	dest_reg = maskR8((opcode & 0b00111000) >> 3);
 }
 
 // Register to [HL]
-void CPU::RHL() {
+template<class Memory>
+void CPU<Memory>::RHL() {
 	fetched_data = *maskR8(opcode & 0b00000111);
 	dest_address = registers.HL.full;
 }
 
 // Data to Register
-void CPU::NTR() {
-	fetched_data = readBus(registers.PC);
-	registers.PC++;
+template<class Memory>
+void CPU<Memory>::NTR() {
+	fetched_data = readPC();
 
 	dest_reg = maskR8((opcode & 0b00111000) >> 3);
 }
 
 // Data to [HL]
-void CPU::NTH() {
-	fetched_data = readBus(registers.PC);
-	registers.PC++;
+template<class Memory>
+void CPU<Memory>::NTH() {
+	fetched_data = readPC();
 
 	dest_address = registers.HL.full;
 }
 
 // Indirect 16-bits Registers to Accumulator
-void CPU::IRA() {
+template<class Memory>
+void CPU<Memory>::IRA() {
 	fetched_data = readBus(maskR16mem((opcode & 0b00110000) >> 4));
 	dest_reg = &registers.AF.hi;
 }
 
 // Accumulator to Indirect 16-bits Registers
-void CPU::IAR() {
+template<class Memory>
+void CPU<Memory>::IAR() {
 	fetched_data = registers.AF.hi;
 	dest_address = maskR16mem((opcode & 0b00110000) >> 4);
 }
 
 // Absolute 16-bits address to Accumulator
-void CPU::ABA() {
-	uint8_t addr_lo = readBus(registers.PC);
-	registers.PC++;
-	
-	uint8_t addr_hi = readBus(registers.PC);
-	registers.PC++;
+template<class Memory>
+void CPU<Memory>::ABA() {
+	uint8_t addr_lo = readPC();
+	uint8_t addr_hi = readPC();
 
 	fetched_data = readBus((addr_hi << 8) | addr_lo);
 	dest_reg = &registers.AF.hi;
 }
 
 // Accumulator to Absolute 16-bits
-void CPU::AAB() {
-	uint8_t addr_lo = readBus(registers.PC);
-	registers.PC++;
-
-	uint8_t addr_hi = readBus(registers.PC);
-	registers.PC++;
+template<class Memory>
+void CPU<Memory>::AAB() {
+	uint8_t addr_lo = readPC();
+	uint8_t addr_hi = readPC();
 
 	fetched_data = registers.AF.hi;
 	dest_address = (addr_hi << 8) | addr_lo;
 }
 
 // Accumulator to Absolute 8-bits
-void CPU::AA8() {
-	uint8_t addr = readBus(registers.PC);
-	registers.PC++;
+template<class Memory>
+void CPU<Memory>::AA8() {
+	uint8_t addr = readPC();
 
 	fetched_data = registers.AF.hi;
 	dest_address = 0xFF00 | addr;
 }
 
 // Absolute 8-bits address to Accumulator
-void CPU::A8A() {
-	uint8_t addr = readBus(registers.PC);
-	registers.PC++;
+template<class Memory>
+void CPU<Memory>::A8A() {
+	uint8_t addr = readPC();
 
 	fetched_data = readBus(0xFF00 | addr);
 	dest_reg = &registers.AF.hi;
 }
 
 // Accumulator to [C]
-void CPU::IAC() {
+template<class Memory>
+void CPU<Memory>::IAC() {
 	fetched_data = registers.AF.hi;
 	dest_address = 0xFF00 | registers.BC.lo;
 }
 
 // [C] to Accumulator
-void CPU::ICA() {
+template<class Memory>
+void CPU<Memory>::ICA() {
 	fetched_data = readBus(0xFF00 | registers.BC.lo);
 	dest_reg = &registers.AF.hi;
 }
 
 
 // Data to Register 16-bit
-void CPU::N16() {
-	fetched_data = readBus(registers.PC);
-	registers.PC++;
-
-	fetched_data |= readBus(registers.PC) << 8;
-	registers.PC++;
+template<class Memory>
+void CPU<Memory>::N16() {
+	fetched_data = readPC();
+	fetched_data |= readPC() << 8;
 
 	dest_reg16 = maskR16((opcode & 0b00110000) >> 4);
 }
 
 // SP to Absolute 16-bits address to Accumulator
-void CPU::SAB() {
-	dest_address = readBus(registers.PC);
-	registers.PC++;
-
-	dest_address |= readBus(registers.PC) << 8;
-	registers.PC++;
+template<class Memory>
+void CPU<Memory>::SAB() {
+	dest_address = readPC();
+	dest_address |= readPC() << 8;
 }
 
 // HL to SP
-void CPU::HTS() {
+template<class Memory>
+void CPU<Memory>::HTS() {
 	fetched_data = registers.HL.full;
 	dest_reg16 = &registers.SP;
 }
 
 // SP+e to HL
-void CPU::STH() {
+template<class Memory>
+void CPU<Memory>::STH() {
 	fetched_data = registers.SP;
 	dest_reg16 = &registers.HL.full;
 }
 
 // Register to Stack
-void CPU::RTS() {
+template<class Memory>
+void CPU<Memory>::RTS() {
+#if CPU_LAZY_FLAGS
+	// PUSH AF reads F
+	if ((opcode & 0b00110000) == 0b00110000) {
+		syncFlags();
+	}
+#endif
+
 	fetched_data = *maskR16stk((opcode & 0b00110000) >> 4);
 }
 
 // Stack to Register
-void CPU::STR() {
+template<class Memory>
+void CPU<Memory>::STR() {
 	dest_reg16 = maskR16stk((opcode & 0b00110000) >> 4);
 }
 
 // Register
-void CPU::REG() {
+template<class Memory>
+void CPU<Memory>::REG() {
 	dest_reg = maskR8(opcode & 0b111);
 
 	if (dest_reg) {
@@ -367,7 +1625,8 @@ void CPU::REG() {
 }
 
 // Middle Register
-void CPU::MRG() {
+template<class Memory>
+void CPU<Memory>::MRG() {
 	dest_reg = maskR8((opcode & 0b00111000) >> 3);
 
 	if (dest_reg) {
@@ -380,28 +1639,28 @@ void CPU::MRG() {
 }
 
 // Immediate
-void CPU::IMM() {
-	fetched_data = readBus(registers.PC);
-	registers.PC++;
+template<class Memory>
+void CPU<Memory>::IMM() {
+	fetched_data = readPC();
 }
 
 // Immediate 16-Bits
-void CPU::IM6() {
-	fetched_data = readBus(registers.PC);
-	registers.PC++;
-
-	fetched_data |= readBus(registers.PC) << 8;
-	registers.PC++;
+template<class Memory>
+void CPU<Memory>::IM6() {
+	fetched_data = readPC();
+	fetched_data |= readPC() << 8;
 }
 
 // 16-bit Registers
-void CPU::R16() {
+template<class Memory>
+void CPU<Memory>::R16() {
 	dest_reg16 = maskR16((opcode & 0b00110000) >> 4);
 }
 
 
 // 16-bit Registers to HL
-void CPU::RTH() {
+template<class Memory>
+void CPU<Memory>::RTH() {
 	fetched_data = *maskR16((opcode & 0b00110000) >> 4);
 }
 
@@ -410,7 +1669,8 @@ void CPU::RTH() {
 /// ///////////// ///
 
 // Mask for 8-bit registed access
-uint8_t* CPU::maskR8(uint8_t bits) {
+template<class Memory>
+uint8_t* CPU<Memory>::maskR8(uint8_t bits) {
 	switch (bits) {
 	case 0b000: // B
 		return &registers.BC.hi;
@@ -434,7 +1694,8 @@ uint8_t* CPU::maskR8(uint8_t bits) {
 }
 
 // Mask for 16-bit registed access
-uint16_t* CPU::maskR16(uint8_t bits) {
+template<class Memory>
+uint16_t* CPU<Memory>::maskR16(uint8_t bits) {
 	switch (bits) {
 	case 0b00: // BC
 		return &registers.BC.full;
@@ -450,7 +1711,8 @@ uint16_t* CPU::maskR16(uint8_t bits) {
 }
 
 // Mask for 16-bit registed access to stack
-uint16_t* CPU::maskR16stk(uint8_t bits) {
+template<class Memory>
+uint16_t* CPU<Memory>::maskR16stk(uint8_t bits) {
 	switch (bits) {
 	case 0b00: // BC
 		return &registers.BC.full;
@@ -466,7 +1728,8 @@ uint16_t* CPU::maskR16stk(uint8_t bits) {
 }
 
 // Mask for register-based 16-bits indirect memory access
-uint16_t CPU::maskR16mem(uint8_t bits) {
+template<class Memory>
+uint16_t CPU<Memory>::maskR16mem(uint8_t bits) {
 	switch (bits) {
 	case 0b00: // BC
 		return registers.BC.full;
@@ -482,7 +1745,8 @@ uint16_t CPU::maskR16mem(uint8_t bits) {
 }
 
 // Mask for condition
-bool CPU::maskCond(uint8_t bits) {
+template<class Memory>
+bool CPU<Memory>::maskCond(uint8_t bits) {
 	switch (bits) {
 	case 0b00: // Non-Zero
 		return !getFlag(cpu_flags_t::z);
@@ -498,7 +1762,8 @@ bool CPU::maskCond(uint8_t bits) {
 }
 
 // Mast to target address
-uint8_t CPU::maskTarget(uint8_t bits) {
+template<class Memory>
+uint8_t CPU<Memory>::maskTarget(uint8_t bits) {
 	return  bits << 3;
 }
 
@@ -508,23 +1773,27 @@ uint8_t CPU::maskTarget(uint8_t bits) {
 /// ////////////////////// ///
 
 // NOP instruction
-void CPU::NOP() {
+template<class Memory>
+void CPU<Memory>::NOP() {
 	return;
 }
 
 // Enter CPU in low power state (awaiting interrupt)
-void CPU::HLT() {
+template<class Memory>
+void CPU<Memory>::HLT() {
 	isHalt = true;
 }
 
 // Enter CPU in very low power state
-void CPU::STP() {
+template<class Memory>
+void CPU<Memory>::STP() {
 	isStop = true;
-	bus->timer.divider = 0x00; // The timer is reset when CPU is stopped
+	bus->setStopped(true); // The timer is reset and stopped along with the CPU
 }
 
 // Load 8-bit
-void CPU::LD8() {
+template<class Memory>
+void CPU<Memory>::LD8() {
 	if (dest_reg) {
 		*dest_reg = (uint8_t)fetched_data;
 	}
@@ -534,24 +1803,26 @@ void CPU::LD8() {
 }
 
 // Load 16-bit
-void CPU::L16() {
+template<class Memory>
+void CPU<Memory>::L16() {
 	if (dest_reg16) {
 		*dest_reg16 = (uint16_t)fetched_data;
 	}
 }
 
 // Load SP to ABS
-void CPU::LDS() {
+template<class Memory>
+void CPU<Memory>::LDS() {
 	writeBus(dest_address, registers.SP & 0xFF);
 	writeBus(dest_address + 1, (registers.SP & 0xFF00) >> 8);
 }
 
 // Load SP + e to HL
-void CPU::LHS() {
+template<class Memory>
+void CPU<Memory>::LHS() {
 	if (dest_reg16) {
-		int8_t e = readBus(registers.PC);
-		registers.PC++;
-		
+		int8_t e = readPC();
+
 		setFlags(
 			0, 
 			0, 
@@ -564,7 +1835,10 @@ void CPU::LHS() {
 }
 
 // Push Register to Stack
-void CPU::PSH() {
+template<class Memory>
+void CPU<Memory>::PSH() {
+	tick(); // Internal delay before writing
+
 	registers.SP--;
 	writeBus(registers.SP, (fetched_data & 0xFF00) >> 8);
 
@@ -573,125 +1847,74 @@ void CPU::PSH() {
 }
 
 // Pop Stack to Register
-void CPU::POP() {
+template<class Memory>
+void CPU<Memory>::POP() {
 	*dest_reg16 = readBus(registers.SP);
 	registers.SP++;
 
 	*dest_reg16 |= readBus(registers.SP) << 8;
 	registers.SP++;
+
+#if CPU_LAZY_FLAGS
+	// POP AF overwrites F, pending flags are dropped and unused flags are cleared here instead of after every instruction
+	if (dest_reg16 == &registers.AF.full) {
+		lazyFlags.op = cpu_lazy_op_t::none;
+		registers.AF.lo &= 0xF0;
+	}
+#endif
 }
 
 // ADD : Add to A
-void CPU::ADD() {
-	uint8_t result = fetched_data + registers.AF.hi;
-	setFlags(
-		!result,
-		0,
-		(((fetched_data & 0xF) + (registers.AF.hi & 0xF)) & 0x10) == 0x10,
-		fetched_data + registers.AF.hi > 0xFF
-	);
-	
-	registers.AF.hi = result;
+template<class Memory>
+void CPU<Memory>::ADD() {
+	add8((uint8_t)fetched_data);
 }
 
 // ADC : Add with carry to A
-void CPU::ADC() {
-	uint8_t c = getFlag(cpu_flags_t::c);
-	uint8_t result = fetched_data + registers.AF.hi + c;
-
-	setFlags(
-		!result,
-		0,
-		(((fetched_data & 0xF) + (registers.AF.hi & 0xF) + c) & 0x10) == 0x10,
-		(fetched_data + registers.AF.hi + c )> 0xFF
-	);
-
-	registers.AF.hi = result;
+template<class Memory>
+void CPU<Memory>::ADC() {
+	adc8((uint8_t)fetched_data);
 }
 
 // SUB : Aubstract to A
-void CPU::SUB() {
-	uint8_t result = registers.AF.hi - fetched_data;
-	setFlags(
-		!result,
-		1,
-		(((registers.AF.hi & 0xF) - (fetched_data & 0xF)) & 0x10) == 0x10,
-		registers.AF.hi < fetched_data
-	);
-
-	registers.AF.hi = result;
+template<class Memory>
+void CPU<Memory>::SUB() {
+	sub8((uint8_t)fetched_data);
 }
 
 // SBC : Substract with carry to A
-void CPU::SBC() {
-	uint8_t c = getFlag(cpu_flags_t::c);
-	uint8_t result = registers.AF.hi - fetched_data - c;
-
-	setFlags(
-		!result,
-		1,
-		(((registers.AF.hi & 0xF) - (fetched_data & 0xF) - c) & 0x10) == 0x10,
-		registers.AF.hi < (fetched_data + c)
-	);
-
-	registers.AF.hi = result;
+template<class Memory>
+void CPU<Memory>::SBC() {
+	sbc8((uint8_t)fetched_data);
 }
 
 // CMP : Compare with A
-void CPU::CMP() {
-	uint8_t result = registers.AF.hi - fetched_data;
-	setFlags(
-		!result,
-		1,
-		(((registers.AF.hi & 0xF) - (fetched_data & 0xF)) & 0x10) == 0x10,
-		registers.AF.hi < fetched_data
-	);
+template<class Memory>
+void CPU<Memory>::CMP() {
+	cp8((uint8_t)fetched_data);
 }
 
 // AND to Accumulator
-void CPU::AND() {
-	uint8_t result = fetched_data & registers.AF.hi;
-
-	setFlags(
-		!result,
-		0,
-		1,
-		0
-	);
-
-	registers.AF.hi = result;
+template<class Memory>
+void CPU<Memory>::AND() {
+	and8((uint8_t)fetched_data);
 }
 
 // OR to Accumulator
-void CPU::_OR() {
-	uint8_t result = fetched_data | registers.AF.hi;
-
-	setFlags(
-		!result,
-		0,
-		0,
-		0
-	);
-
-	registers.AF.hi = result;
+template<class Memory>
+void CPU<Memory>::_OR() {
+	or8((uint8_t)fetched_data);
 }
 
 // XOR to Accumulator
-void CPU::XOR() {
-	uint8_t result = fetched_data ^ registers.AF.hi;
-
-	setFlags(
-		!result,
-		0,
-		0,
-		0
-	);
-
-	registers.AF.hi = result;
+template<class Memory>
+void CPU<Memory>::XOR() {
+	xor8((uint8_t)fetched_data);
 }
 
 // Flip Carry Flag
-void CPU::CCF() {
+template<class Memory>
+void CPU<Memory>::CCF() {
 	setFlags(
 		getFlag(cpu_flags_t::z),
 		0,
@@ -701,7 +1924,8 @@ void CPU::CCF() {
 }
 
 // Set Carry Flag
-void CPU::SCF() {
+template<class Memory>
+void CPU<Memory>::SCF() {
 	setFlags(
 		getFlag(cpu_flags_t::z),
 		0,
@@ -711,7 +1935,8 @@ void CPU::SCF() {
 }
 
 // Decimal adjust accumulator
-void CPU::DAA() {
+template<class Memory>
+void CPU<Memory>::DAA() {
 	if (!getFlag(cpu_flags_t::n)) {
 		if (getFlag(cpu_flags_t::c) || registers.AF.hi > 0x99) {
 			registers.AF.hi += 0x60;
@@ -735,7 +1960,8 @@ void CPU::DAA() {
 }
 
 // Complement accumulator
-void CPU::CPL() {
+template<class Memory>
+void CPU<Memory>::CPL() {
 	registers.AF.hi = ~registers.AF.hi;
 
 	setFlag(cpu_flags_t::n, true);
@@ -744,14 +1970,9 @@ void CPU::CPL() {
 
 
 // Increment Register
-void CPU::INC() {
-	uint8_t result = fetched_data + 0x01;
-	setFlags(
-		!result,
-		0,
-		(((fetched_data & 0xF) + 0x01) & 0x10) == 0x10,
-		getFlag(cpu_flags_t::c)
-	);
+template<class Memory>
+void CPU<Memory>::INC() {
+	uint8_t result = inc8((uint8_t)fetched_data);
 
 	if (dest_reg) {
 		*dest_reg = result;
@@ -762,19 +1983,15 @@ void CPU::INC() {
 }
 
 // Increment Register 16_bit
-void CPU::I16() {
+template<class Memory>
+void CPU<Memory>::I16() {
 	(*dest_reg16)++;
 }
 
 // Decrement Register
-void CPU::DEC() {
-	uint8_t result = fetched_data - 0x01;
-	setFlags(
-		!result,
-		1,
-		(((fetched_data & 0xF) - 0x01) & 0x10) == 0x10,
-		getFlag(cpu_flags_t::c)
-	);
+template<class Memory>
+void CPU<Memory>::DEC() {
+	uint8_t result = dec8((uint8_t)fetched_data);
 
 	if (dest_reg) {
 		*dest_reg = result;
@@ -785,26 +2002,20 @@ void CPU::DEC() {
 }
 
 // Decrement Register 16_bit
-void CPU::D16() {
+template<class Memory>
+void CPU<Memory>::D16() {
 	(*dest_reg16)--;
 }
 
 // Add 16-bit
-void CPU::A16() {
-	uint16_t result = registers.HL.full + fetched_data;
-	
-	setFlags(
-		getFlag(cpu_flags_t::z),
-		0,
-		(((registers.HL.full & 0xFFF) + (fetched_data & 0xFFF)) & 0x1000) == 0x1000,
-		registers.HL.full + fetched_data > 0xFFFF
-	);
-	
-	registers.HL.full = result;
+template<class Memory>
+void CPU<Memory>::A16() {
+	add16(fetched_data);
 }
 
 // ADD to SP E value
-void CPU::ASP() {
+template<class Memory>
+void CPU<Memory>::ASP() {
 	uint16_t result = registers.SP + (int8_t)fetched_data;
 
 	setFlags(
@@ -818,7 +2029,8 @@ void CPU::ASP() {
 }
 
 // Rotate Left on Accumulator
-void CPU::RLCA() {
+template<class Memory>
+void CPU<Memory>::RLCA() {
 	setFlags(
 		0,
 		0,
@@ -830,7 +2042,8 @@ void CPU::RLCA() {
 } 
 
 // Rotate Leftthrough Carry on Accumulator
-void CPU::RLA() {
+template<class Memory>
+void CPU<Memory>::RLA() {
 	uint8_t tmp = getFlag(cpu_flags_t::c);
 
 	setFlags(
@@ -844,7 +2057,8 @@ void CPU::RLA() {
 }	
 
 // Rotate Right on Accumulator
-void CPU::RRCA() {
+template<class Memory>
+void CPU<Memory>::RRCA() {
 	setFlags(
 		0,
 		0,
@@ -856,7 +2070,8 @@ void CPU::RRCA() {
 }
 
 // Rotate Right through Carry on Accumulator
-void CPU::RRA() {
+template<class Memory>
+void CPU<Memory>::RRA() {
 	uint8_t tmp = getFlag(cpu_flags_t::c) << 7;
 
 	setFlags(
@@ -874,24 +2089,18 @@ void CPU::RRA() {
 /// ///////////////////// ///
 
 // Prefix instruction
-void CPU::PRE() {
-	opcode = readBus(registers.PC);
-	registers.PC++;
+template<class Memory>
+void CPU<Memory>::PRE() {
+	opcode = readPC();
 
 	REG();
 	(this->*prefixed[opcode].operate)();
 }
 
 // Rotate Left
-void CPU::RLC() {
-	uint8_t result = (fetched_data << 1) | ((fetched_data & 0x80) >> 7);
-
-	setFlags(
-		!result,
-		0,
-		0,
-		fetched_data & 0x80
-	);
+template<class Memory>
+void CPU<Memory>::RLC() {
+	uint8_t result = rlc8((uint8_t)fetched_data);
 
 	if (dest_reg) {
 		*dest_reg = result;
@@ -901,16 +2110,10 @@ void CPU::RLC() {
 	}
 }
 
-// Rotate Leftthrough Carry
-void CPU::_RL() {
-	uint8_t result = (fetched_data << 1) | getFlag(cpu_flags_t::c);
-
-	setFlags(
-		!result,
-		0,
-		0,
-		fetched_data & 0x80
-	);
+// Rotate Leftthrough Carry
+template<class Memory>
+void CPU<Memory>::_RL() {
+	uint8_t result = rl8((uint8_t)fetched_data);
 
 	if (dest_reg) {
 		*dest_reg = result;
@@ -921,15 +2124,9 @@ void CPU::_RL() {
 }
 
 // Rotate Right
-void CPU::RRC() {
-	uint8_t result = (fetched_data >> 1) | ((fetched_data & 0x01) << 7);
-
-	setFlags(
-		!result,
-		0,
-		0,
-		fetched_data & 0x01
-	);
+template<class Memory>
+void CPU<Memory>::RRC() {
+	uint8_t result = rrc8((uint8_t)fetched_data);
 
 	if (dest_reg) {
 		*dest_reg = result;
@@ -940,15 +2137,9 @@ void CPU::RRC() {
 }
 
 // Rotate Right through Carry
-void CPU::_RR() {
-	uint8_t result = (fetched_data >> 1) | getFlag(cpu_flags_t::c) << 7;
-
-	setFlags(
-		!result,
-		0,
-		0,
-		fetched_data & 0x01
-	);
+template<class Memory>
+void CPU<Memory>::_RR() {
+	uint8_t result = rr8((uint8_t)fetched_data);
 
 	if (dest_reg) {
 		*dest_reg = result;
@@ -959,15 +2150,9 @@ void CPU::_RR() {
 }
 
 // Shift Left
-void CPU::SLA() {
-	uint8_t result = fetched_data << 1;
-
-	setFlags(
-		!result,
-		0,
-		0,
-		fetched_data & 0x80
-	);
+template<class Memory>
+void CPU<Memory>::SLA() {
+	uint8_t result = sla8((uint8_t)fetched_data);
 
 	if (dest_reg) {
 		*dest_reg = result;
@@ -978,15 +2163,9 @@ void CPU::SLA() {
 }
 
 // Shift Right
-void CPU::SRA() {
-	uint8_t result = (fetched_data & 0x80) | (fetched_data >> 1);
-
-	setFlags(
-		!result,
-		0,
-		0,
-		fetched_data & 0x01
-	);
+template<class Memory>
+void CPU<Memory>::SRA() {
+	uint8_t result = sra8((uint8_t)fetched_data);
 
 	if (dest_reg) {
 		*dest_reg = result;
@@ -997,15 +2176,9 @@ void CPU::SRA() {
 }
 
 // Shift Right Logically
-void CPU::SRL() {
-	uint8_t result = fetched_data >> 1;
-
-	setFlags(
-		!result,
-		0,
-		0,
-		fetched_data & 0x01
-	);
+template<class Memory>
+void CPU<Memory>::SRL() {
+	uint8_t result = srl8((uint8_t)fetched_data);
 
 	if (dest_reg) {
 		*dest_reg = result;
@@ -1016,15 +2189,9 @@ void CPU::SRL() {
 }
 
 // Swap upper and lower 4 bits
-void CPU::SWP() {
-	uint8_t result = ((fetched_data & 0xF) << 4) | ((fetched_data & 0xF0) >> 4);
-
-	setFlags(
-		!result,
-		0,
-		0,
-		0
-	);
+template<class Memory>
+void CPU<Memory>::SWP() {
+	uint8_t result = swap8((uint8_t)fetched_data);
 
 	if (dest_reg) {
 		*dest_reg = result;
@@ -1035,17 +2202,14 @@ void CPU::SWP() {
 }
 
 // Test the x Bit of Register
-void CPU::BIT() {
-	setFlags(
-		!(fetched_data & (1 << ((opcode & 0b00111000) >> 3))),
-		0,
-		1,
-		getFlag(cpu_flags_t::c)
-	);
+template<class Memory>
+void CPU<Memory>::BIT() {
+	bit8((uint8_t)fetched_data, (opcode & 0b00111000) >> 3);
 }
 
 // Reset the x Bit of Register
-void CPU::RES() {
+template<class Memory>
+void CPU<Memory>::RES() {
 	uint8_t result = fetched_data & ~(1 << ((opcode & 0b00111000) >> 3));
 
 	if (dest_reg) {
@@ -1057,7 +2221,8 @@ void CPU::RES() {
 }
 
 // Set the x Bit of Register
-void CPU::SET() {
+template<class Memory>
+void CPU<Memory>::SET() {
 	uint8_t result = fetched_data | (1 << ((opcode & 0b00111000) >> 3));
 
 	if (dest_reg) {
@@ -1069,38 +2234,58 @@ void CPU::SET() {
 }
 
 // Jump unconditonal to n16
-void CPU::_JP() {
+template<class Memory>
+void CPU<Memory>::_JP() {
 	registers.PC = fetched_data;
 }
 
 // Jump unconditonal to HL
-void CPU::JPH() {
+template<class Memory>
+void CPU<Memory>::JPH() {
 	registers.PC = registers.HL.full;
 }
 
 // Jump conditionally to HL
-void CPU::JPC() {
-	if (maskCond((opcode & 0b00011000) >> 3)) {
+template<class Memory>
+void CPU<Memory>::JPC() {
+	if (isBranchTaken) {
 		registers.PC = fetched_data;
 	}
 }
 
 // Jump unconditonal to E
-void CPU::_JR() {
+template<class Memory>
+void CPU<Memory>::_JR() {
 	registers.PC += (int8_t)fetched_data;
+
+#if CPU_IDLE_SKIP
+	if ((int8_t)fetched_data < 0) {
+		loopStart = registers.PC;
+	}
+#endif
 }
 
 // Jump conditionally to E
-void CPU::JRC() {
+template<class Memory>
+void CPU<Memory>::JRC() {
 	uint16_t dest = registers.PC + (int8_t)fetched_data;
 
-	if (maskCond((opcode & 0b00011000) >> 3)) {
+	if (isBranchTaken) {
 		registers.PC = dest;
+
+#if CPU_IDLE_SKIP
+		if ((int8_t)fetched_data < 0) {
+			loopStart = dest;
+		}
+#endif
 	}
 }
 
 // Call unconditionally n16
-void CPU::CLL() {
+template<class Memory>
+void CPU<Memory>::CLL() {
+	tick(); // Internal delay before writing
+
 	registers.SP--;
 	writeBus(registers.SP, (registers.PC & 0xFF00) >> 8);
 
@@ -1111,9 +2296,11 @@ void CPU::CLL() {
 }
 
 // Call conditionally n16
-void CPU::CLC() {
+template<class Memory>
+void CPU<Memory>::CLC() {
+	if (isBranchTaken) {
+		tick(); // Internal delay before writing
 
-	if (maskCond((opcode & 0b00011000) >> 3)) {
 		registers.SP--;
 		writeBus(registers.SP, (registers.PC & 0xFF00) >> 8);
 
@@ -1125,7 +2312,8 @@ void CPU::CLC() {
 }
 
 // Return from function uncondtionally
-void CPU::RET() {
+template<class Memory>
+void CPU<Memory>::RET() {
 	uint16_t dest = readBus(registers.SP);
 	registers.SP++;
 
@@ -1136,8 +2324,11 @@ void CPU::RET() {
 }
 
 // Return from function condtionally
-void CPU::REC() {
-	if (maskCond((opcode & 0b00011000) >> 3)) {
+template<class Memory>
+void CPU<Memory>::REC() {
+	tick(); // Internal delay of the condition check
+
+	if (isBranchTaken) {
 		uint16_t dest = readBus(registers.SP);
 		registers.SP++;
 
@@ -1149,7 +2340,8 @@ void CPU::REC() {
 }
 
 // Return from interrupt handler
-void CPU::REI() {
+template<class Memory>
+void CPU<Memory>::REI() {
 	uint16_t dest = readBus(registers.SP);
 	registers.SP++;
 
@@ -1158,11 +2350,14 @@ void CPU::REI() {
 
 	registers.PC = dest;
 
-	IME = true;
+	interrupts->setIME(true);
 }
 
 // Restart to Target
-void CPU::RST() {
+template<class Memory>
+void CPU<Memory>::RST() {
+	tick(); // Internal delay before writing
+
 	registers.SP--;
 	writeBus(registers.SP, (registers.PC & 0xFF00) >> 8);
 
@@ -1173,23 +2368,557 @@ void CPU::RST() {
 }
 
 // Scedule IME
-void CPU::_EI() {
+template<class Memory>
+void CPU<Memory>::_EI() {
 	IMEScheduled = true;
 }
 
 // Disable IME
-void CPU::_DI() {
-	IME = false;
+template<class Memory>
+void CPU<Memory>::_DI() {
+	interrupts->setIME(false);
 }
 
 // Not supported insctruction
-void CPU::XXX() {
-	std::cout << "Opcode non supported: " << std::hex << std::uppercase << (opcode < 0x10 ? "0" : "") << opcode << std::endl;
+template<class Memory>
+void CPU<Memory>::XXX() {
+#if DEBUG_HOOKS
+	if (hooks && hooks->onUnsupported) {
+		hooks->onUnsupported(hooks->context, registers.PC - 1, opcode);
+	}
+#endif
 }
 
 // Illegal opcode
-void CPU::ILL() {
-	std::cout << "Illegal opcode non supported: " << std::hex << std::uppercase << (opcode < 0x10 ? "0" : "") << opcode << std::endl;
+template<class Memory>
+void CPU<Memory>::ILL() {
+#if DEBUG_HOOKS
+	if (hooks && hooks->onUnsupported) {
+		hooks->onUnsupported(hooks->context, registers.PC - 1, opcode);
+	}
+#endif
+}
+
+
+/// ////////////// ///
+///	ALU operations ///
+/// ////////////// ///
+
+// Add to A
+template<class Memory>
+void CPU<Memory>::add8(uint8_t v) {
+	uint8_t result = v + registers.AF.hi;
+#if CPU_LAZY_FLAGS
+	recordFlags(cpu_lazy_op_t::add, registers.AF.hi, v, 0, result);
+#else
+	setFlags(
+		!result,
+		0,
+		(((v & 0xF) + (registers.AF.hi & 0xF)) & 0x10) == 0x10,
+		v + registers.AF.hi > 0xFF
+	);
+#endif
+
+	registers.AF.hi = result;
+}
+
+// Add with carry to A
+template<class Memory>
+void CPU<Memory>::adc8(uint8_t v) {
+	uint8_t c = getFlag(cpu_flags_t::c);
+	uint8_t result = v + registers.AF.hi + c;
+
+#if CPU_LAZY_FLAGS
+	recordFlags(cpu_lazy_op_t::adc, registers.AF.hi, v, c, result);
+#else
+	setFlags(
+		!result,
+		0,
+		(((v & 0xF) + (registers.AF.hi & 0xF) + c) & 0x10) == 0x10,
+		(v + registers.AF.hi + c) > 0xFF
+	);
+#endif
+
+	registers.AF.hi = result;
+}
+
+// Substract to A
+template<class Memory>
+void CPU<Memory>::sub8(uint8_t v) {
+	uint8_t result = registers.AF.hi - v;
+#if CPU_LAZY_FLAGS
+	recordFlags(cpu_lazy_op_t::sub, registers.AF.hi, v, 0, result);
+#else
+	setFlags(
+		!result,
+		1,
+		(((registers.AF.hi & 0xF) - (v & 0xF)) & 0x10) == 0x10,
+		registers.AF.hi < v
+	);
+#endif
+
+	registers.AF.hi = result;
+}
+
+// Substract with carry to A
+template<class Memory>
+void CPU<Memory>::sbc8(uint8_t v) {
+	uint8_t c = getFlag(cpu_flags_t::c);
+	uint8_t result = registers.AF.hi - v - c;
+
+#if CPU_LAZY_FLAGS
+	recordFlags(cpu_lazy_op_t::sbc, registers.AF.hi, v, c, result);
+#else
+	setFlags(
+		!result,
+		1,
+		(((registers.AF.hi & 0xF) - (v & 0xF) - c) & 0x10) == 0x10,
+		registers.AF.hi < (v + c)
+	);
+#endif
+
+	registers.AF.hi = result;
+}
+
+// Compare with A
+template<class Memory>
+void CPU<Memory>::cp8(uint8_t v) {
+	uint8_t result = registers.AF.hi - v;
+#if CPU_LAZY_FLAGS
+	recordFlags(cpu_lazy_op_t::cp, registers.AF.hi, v, 0, result);
+#else
+	setFlags(
+		!result,
+		1,
+		(((registers.AF.hi & 0xF) - (v & 0xF)) & 0x10) == 0x10,
+		registers.AF.hi < v
+	);
+#endif
+}
+
+// AND to A
+template<class Memory>
+void CPU<Memory>::and8(uint8_t v) {
+	registers.AF.hi &= v;
+#if CPU_LAZY_FLAGS
+	recordFlags(cpu_lazy_op_t::bitAnd, 0, 0, 0, registers.AF.hi);
+#else
+	setFlags(!registers.AF.hi, 0, 1, 0);
+#endif
+}
+
+// OR to A
+template<class Memory>
+void CPU<Memory>::or8(uint8_t v) {
+	registers.AF.hi |= v;
+#if CPU_LAZY_FLAGS
+	recordFlags(cpu_lazy_op_t::bitOr, 0, 0, 0, registers.AF.hi);
+#else
+	setFlags(!registers.AF.hi, 0, 0, 0);
+#endif
+}
+
+// XOR to A
+template<class Memory>
+void CPU<Memory>::xor8(uint8_t v) {
+	registers.AF.hi ^= v;
+#if CPU_LAZY_FLAGS
+	recordFlags(cpu_lazy_op_t::bitOr, 0, 0, 0, registers.AF.hi);
+#else
+	setFlags(!registers.AF.hi, 0, 0, 0);
+#endif
+}
+
+// Increment (Carry flag is not affected)
+template<class Memory>
+uint8_t CPU<Memory>::inc8(uint8_t v) {
+	uint8_t result = v + 0x01;
+#if CPU_LAZY_FLAGS
+	recordFlags(cpu_lazy_op_t::inc, v, 0, getFlag(cpu_flags_t::c), result);
+#else
+	setFlags(
+		!result,
+		0,
+		(((v & 0xF) + 0x01) & 0x10) == 0x10,
+		getFlag(cpu_flags_t::c)
+	);
+#endif
+
+	return result;
+}
+
+// Decrement (Carry flag is not affected)
+template<class Memory>
+uint8_t CPU<Memory>::dec8(uint8_t v) {
+	uint8_t result = v - 0x01;
+#if CPU_LAZY_FLAGS
+	recordFlags(cpu_lazy_op_t::dec, v, 0, getFlag(cpu_flags_t::c), result);
+#else
+	setFlags(
+		!result,
+		1,
+		(((v & 0xF) - 0x01) & 0x10) == 0x10,
+		getFlag(cpu_flags_t::c)
+	);
+#endif
+
+	return result;
+}
+
+// Add to HL (Zero flag is not affected)
+template<class Memory>
+void CPU<Memory>::add16(uint16_t v) {
+	uint16_t result = registers.HL.full + v;
+
+#if CPU_LAZY_FLAGS
+	recordFlags(cpu_lazy_op_t::add16, registers.HL.full, v, 0, !getFlag(cpu_flags_t::z)); // Result only holds the unchanged Zero flag
+#else
+	setFlags(
+		getFlag(cpu_flags_t::z),
+		0,
+		(((registers.HL.full & 0xFFF) + (v & 0xFFF)) & 0x1000) == 0x1000,
+		registers.HL.full + v > 0xFFFF
+	);
+#endif
+
+	registers.HL.full = result;
+}
+
+// Rotate Left
+template<class Memory>
+uint8_t CPU<Memory>::rlc8(uint8_t v) {
+	uint8_t result = (v << 1) | ((v & 0x80) >> 7);
+
+#if CPU_LAZY_FLAGS
+	recordFlags(cpu_lazy_op_t::shift, 0, 0, (v & 0x80) != 0, result);
+#else
+	setFlags(
+		!result,
+		0,
+		0,
+		v & 0x80
+	);
+#endif
+
+	return result;
+}
+
+// Rotate Left through Carry
+template<class Memory>
+uint8_t CPU<Memory>::rl8(uint8_t v) {
+	uint8_t result = (v << 1) | getFlag(cpu_flags_t::c);
+
+#if CPU_LAZY_FLAGS
+	recordFlags(cpu_lazy_op_t::shift, 0, 0, (v & 0x80) != 0, result);
+#else
+	setFlags(
+		!result,
+		0,
+		0,
+		v & 0x80
+	);
+#endif
+
+	return result;
+}
+
+// Rotate Right
+template<class Memory>
+uint8_t CPU<Memory>::rrc8(uint8_t v) {
+	uint8_t result = (v >> 1) | ((v & 0x01) << 7);
+
+#if CPU_LAZY_FLAGS
+	recordFlags(cpu_lazy_op_t::shift, 0, 0, (v & 0x01) != 0, result);
+#else
+	setFlags(
+		!result,
+		0,
+		0,
+		v & 0x01
+	);
+#endif
+
+	return result;
+}
+
+// Rotate Right through Carry
+template<class Memory>
+uint8_t CPU<Memory>::rr8(uint8_t v) {
+	uint8_t result = (v >> 1) | getFlag(cpu_flags_t::c) << 7;
+
+#if CPU_LAZY_FLAGS
+	recordFlags(cpu_lazy_op_t::shift, 0, 0, (v & 0x01) != 0, result);
+#else
+	setFlags(
+		!result,
+		0,
+		0,
+		v & 0x01
+	);
+#endif
+
+	return result;
+}
+
+// Shift Left
+template<class Memory>
+uint8_t CPU<Memory>::sla8(uint8_t v) {
+	uint8_t result = v << 1;
+
+#if CPU_LAZY_FLAGS
+	recordFlags(cpu_lazy_op_t::shift, 0, 0, (v & 0x80) != 0, result);
+#else
+	setFlags(
+		!result,
+		0,
+		0,
+		v & 0x80
+	);
+#endif
+
+	return result;
+}
+
+// Shift Right
+template<class Memory>
+uint8_t CPU<Memory>::sra8(uint8_t v) {
+	uint8_t result = (v & 0x80) | (v >> 1);
+
+#if CPU_LAZY_FLAGS
+	recordFlags(cpu_lazy_op_t::shift, 0, 0, (v & 0x01) != 0, result);
+#else
+	setFlags(
+		!result,
+		0,
+		0,
+		v & 0x01
+	);
+#endif
+
+	return result;
+}
+
+// Shift Right Logically
+template<class Memory>
+uint8_t CPU<Memory>::srl8(uint8_t v) {
+	uint8_t result = v >> 1;
+
+#if CPU_LAZY_FLAGS
+	recordFlags(cpu_lazy_op_t::shift, 0, 0, (v & 0x01) != 0, result);
+#else
+	setFlags(
+		!result,
+		0,
+		0,
+		v & 0x01
+	);
+#endif
+
+	return result;
+}
+
+// Swap upper and lower 4 bits
+template<class Memory>
+uint8_t CPU<Memory>::swap8(uint8_t v) {
+	uint8_t result = ((v & 0xF) << 4) | ((v & 0xF0) >> 4);
+
+#if CPU_LAZY_FLAGS
+	recordFlags(cpu_lazy_op_t::shift, 0, 0, 0, result);
+#else
+	setFlags(
+		!result,
+		0,
+		0,
+		0
+	);
+#endif
+
+	return result;
+}
+
+// Test a bit (Carry flag is not affected)
+template<class Memory>
+void CPU<Memory>::bit8(uint8_t v, uint8_t b) {
+#if CPU_LAZY_FLAGS
+	recordFlags(cpu_lazy_op_t::bit, 0, 0, getFlag(cpu_flags_t::c), v & (1 << b));
+#else
+	setFlags(
+		!(v & (1 << b)),
+		0,
+		1,
+		getFlag(cpu_flags_t::c)
+	);
+#endif
+}
+
+
+/// ///////////////////////// ///
+///	Specialized instructions  ///
+/// ///////////////////////// ///
+
+// 8-bit register from its 3-bit code in the opcode (0b110 [HL] is handled by readR8 and writeR8)
+template<class Memory>
+template<uint8_t R>
+uint8_t& CPU<Memory>::reg8() {
+	static_assert(R < 0b1000 && R != 0b110, "Not an 8-bit register");
+
+	if constexpr (R == 0b000) return registers.BC.hi;
+	else if constexpr (R == 0b001) return registers.BC.lo;
+	else if constexpr (R == 0b010) return registers.DE.hi;
+	else if constexpr (R == 0b011) return registers.DE.lo;
+	else if constexpr (R == 0b100) return registers.HL.hi;
+	else if constexpr (R == 0b101) return registers.HL.lo;
+	else return registers.AF.hi;
+}
+
+// 16-bit register from its 2-bit code in the opcode
+template<class Memory>
+template<uint8_t R>
+uint16_t& CPU<Memory>::reg16() {
+	static_assert(R < 0b100, "Not a 16-bit register");
+
+	if constexpr (R == 0b00) return registers.BC.full;
+	else if constexpr (R == 0b01) return registers.DE.full;
+	else if constexpr (R == 0b10) return registers.HL.full;
+	else return registers.SP;
+}
+
+template<class Memory>
+template<uint8_t R>
+uint8_t CPU<Memory>::readR8() {
+	if constexpr (R == 0b110) return readBus(registers.HL.full);
+	else return reg8<R>();
+}
+
+template<class Memory>
+template<uint8_t R>
+void CPU<Memory>::writeR8(uint8_t data) {
+	if constexpr (R == 0b110) writeBus(registers.HL.full, data);
+	else reg8<R>() = data;
+}
+
+// ALU operation from its 3-bit code in the opcode
+template<class Memory>
+template<uint8_t Alu>
+void CPU<Memory>::alu8(uint8_t v) {
+	if constexpr (Alu == 0b000) add8(v);
+	else if constexpr (Alu == 0b001) adc8(v);
+	else if constexpr (Alu == 0b010) sub8(v);
+	else if constexpr (Alu == 0b011) sbc8(v);
+	else if constexpr (Alu == 0b100) and8(v);
+	else if constexpr (Alu == 0b101) xor8(v);
+	else if constexpr (Alu == 0b110) or8(v);
+	else cp8(v);
+}
+
+// LD r8, r8' / LD r8, [HL] / LD [HL], r8
+template<class Memory>
+template<uint8_t Op>
+void CPU<Memory>::ldR8() {
+	writeR8<(Op >> 3) & 0b111>(readR8<Op & 0b111>());
+}
+
+// LD r8, n8 / LD [HL], n8
+template<class Memory>
+template<uint8_t Op>
+void CPU<Memory>::ldR8N8() {
+	uint8_t data = readPC();
+
+	writeR8<(Op >> 3) & 0b111>(data);
+}
+
+// INC r8 / INC [HL]
+template<class Memory>
+template<uint8_t Op>
+void CPU<Memory>::incR8() {
+	constexpr uint8_t R = (Op >> 3) & 0b111;
+	writeR8<R>(inc8(readR8<R>()));
+}
+
+// DEC r8 / DEC [HL]
+template<class Memory>
+template<uint8_t Op>
+void CPU<Memory>::decR8() {
+	constexpr uint8_t R = (Op >> 3) & 0b111;
+	writeR8<R>(dec8(readR8<R>()));
+}
+
+// ALU A, r8 / ALU A, [HL]
+template<class Memory>
+template<uint8_t Op>
+void CPU<Memory>::aluR8() {
+	alu8<(Op >> 3) & 0b111>(readR8<Op & 0b111>());
+}
+
+// ALU A, n8
+template<class Memory>
+template<uint8_t Op>
+void CPU<Memory>::aluN8() {
+	uint8_t data = readPC();
+
+	alu8<(Op >> 3) & 0b111>(data);
+}
+
+// LD r16, n16
+template<class Memory>
+template<uint8_t Op>
+void CPU<Memory>::ldR16() {
+	uint16_t data = readPC();
+	data |= readPC() << 8;
+
+	reg16<(Op >> 4) & 0b11>() = data;
+}
+
+// ADD HL, r16
+template<class Memory>
+template<uint8_t Op>
+void CPU<Memory>::addHL() {
+	add16(reg16<(Op >> 4) & 0b11>());
+}
+
+// INC r16
+template<class Memory>
+template<uint8_t Op>
+void CPU<Memory>::incR16() {
+	reg16<(Op >> 4) & 0b11>()++;
+}
+
+// DEC r16
+template<class Memory>
+template<uint8_t Op>
+void CPU<Memory>::decR16() {
+	reg16<(Op >> 4) & 0b11>()--;
 }
 
+// Prefixed instructions (Op is the opcode following 0xCB)
+template<class Memory>
+template<uint8_t Op>
+void CPU<Memory>::prefixedOp() {
+	constexpr uint8_t R = Op & 0b111;
+	constexpr uint8_t bit = (Op >> 3) & 0b111;
+
+	if constexpr (Op < 0x40) {
+		uint8_t v = readR8<R>();
+
+		if constexpr (bit == 0) writeR8<R>(rlc8(v));
+		else if constexpr (bit == 1) writeR8<R>(rrc8(v));
+		else if constexpr (bit == 2) writeR8<R>(rl8(v));
+		else if constexpr (bit == 3) writeR8<R>(rr8(v));
+		else if constexpr (bit == 4) writeR8<R>(sla8(v));
+		else if constexpr (bit == 5) writeR8<R>(sra8(v));
+		else if constexpr (bit == 6) writeR8<R>(swap8(v));
+		else writeR8<R>(srl8(v));
+	}
+	else if constexpr (Op < 0x80) {
+		bit8(readR8<R>(), bit);
+	}
+	else if constexpr (Op < 0xC0) {
+		writeR8<R>(readR8<R>() & ~(1 << bit));
+	}
+	else {
+		writeR8<R>(readR8<R>() | (1 << bit));
+	}
+}
 
+template class CPU<Bus>;
+template class CPU<FlatMemory>;
@@ -1,15 +1,27 @@
 #pragma once
 
 #include <cstdint>
-#include <string>
-
-class Bus;
-
-class CPU
+#include <ostream>
+#include <vector>
+
+#include "../Config.h"
+#include "BlockCache.h"
+#include "Recompiler.h"
+
+class InterruptController;
+struct DebugHooks;
+
+// Sharp SM83 CPU, generic over the memory it is connected to
+// Memory is Bus for the Game Boy, or FlatMemory for test harnesses running instructions on a plain 64 KiB array
+// A memory type provides read() and write(), advance() and fastForward() for the other components,
+// getCyclesToChange(), getCyclesToInterrupt(), getRomBank() and setStopped(), an 'interrupts' controller,
+// and 'hasRom' telling whether 0x0000-0x7FFF is read-only ROM (block cache, recompiler and polling loops skipping rely on it)
+template<class Memory>
+class alignas(64) CPU
 {
-public:
-	Bus* bus = nullptr;
+	friend class Recompiler;	// Reads the cycles of the instructions tables
 
+public:
 	enum cpu_flags_t {
 		z = (1 << 7),
 		n = (1 << 6),
@@ -28,6 +40,48 @@ public:
 		uint16_t full = 0x0000;
 	};
 
+	// ALU operation whose flags are waiting to be computed (see CPU_LAZY_FLAGS)
+	enum class cpu_lazy_op_t : uint8_t {
+		none,
+		add, adc, sub, sbc, cp,
+		bitAnd, bitOr,	// bitOr is shared by OR and XOR
+		inc, dec,
+		add16,
+		shift,			// Rotates, shifts and SWAP
+		bit
+	};
+
+	struct cpu_lazy_flags_t {
+		cpu_lazy_op_t op;
+		uint8_t result;	// Zero flag is always !result
+		uint8_t c;		// Carry in, carry out or preserved carry depending of the operation
+		uint16_t a;
+		uint16_t b;
+	};
+
+	// Instruction sequences run as one handler (see CPU_FUSION)
+	enum class cpu_fusion_t : uint8_t {
+		decJr,		// DEC r8 / JR NZ, e8
+		cpJr,		// CP n8 / JR cc, e8
+		ldhAluJr,	// LDH A, [n8] / CP n8 or AND n8 / JR cc, e8
+		copy,		// LD A, [HL+] / LD [DE], A / INC DE
+		count
+	};
+
+	// Polling loop: a load into A from memory, an optional test of A and a JR back to the load
+	struct cpu_idle_loop_t {
+		uint32_t key = UINT32_MAX;	// (ROM bank << 16) | address of the load
+		bool isIdle = false;		// Whether the code at this address is a polling loop
+		uint8_t load;				// Opcode of the load
+		uint16_t address;			// Polled address (for loads from an immediate address)
+		uint8_t test;				// Opcode of the test (0x00 if there is none)
+		uint8_t operand;			// Immediate operand of the test (or prefixed opcode of BIT)
+		uint8_t jr;					// Opcode of the JR
+		uint8_t readCycle;			// M-cycle of the iteration on which the value is read
+		uint8_t cycles;				// M-cycles of an iteration
+		uint8_t length;				// Instructions of an iteration
+	};
+
 	struct cpu_registers_t {
 		cpu_register_t AF; // Accumulator & register
 		cpu_register_t BC;
@@ -35,39 +89,160 @@ public:
 		cpu_register_t HL;
 		uint16_t SP = 0x0000;
 		uint16_t PC = 0x0000;
-	} registers;
+	};
+
+	/// ///////// ///
+	///	Hot state ///
+	/// ///////// ///
+
+	// Everything read or written on each instruction, it fits in the first two cache lines of the CPU
+	// so stepping it touches as few lines as possible
+
+	cpu_registers_t registers;
+	cpu_lazy_flags_t lazyFlags = {};
 
 	uint8_t opcode = 0x00;
-	uint16_t fetched_data = 0x0000;
-	uint8_t	*dest_reg = nullptr;
-	uint16_t *dest_reg16 = nullptr;
-	uint16_t dest_address = 0x0000;
 	uint8_t cycles = 0;
+	uint8_t cyclesToTick = 0;	// M-cycles of the instruction being executed left to its bus accesses (see CPU_CYCLE_ACCURATE)
 
 	bool isCycling = false;
+	bool isFetched = false;		// Opcode at PC has already been read by computeCycles()
+	bool isBranchTaken = false;	// Condition of the fetched instruction (if it's a conditional one)
 
-	bool IMEScheduled = false;
-	bool IME = false;
+	bool IMEScheduled = false;	// IME is set after the instruction following EI
 	bool isHalt = false;
 	bool isStop = false;
 
+	uint16_t fetched_data = 0x0000;
+	uint16_t dest_address = 0x0000;
+	uint8_t	*dest_reg = nullptr;
+	uint16_t *dest_reg16 = nullptr;
+
+	Memory* bus = nullptr;
+	InterruptController* interrupts = nullptr;	// Owned by the memory
+
+	uint64_t instructionCount = 0;	// Number of instructions executed since power on (used for benchmarking)
+
+#if CPU_BLOCK_CACHE
+	BlockCache* blockCache = nullptr;	// Only allocated when enabled with setBlockCache()
+#endif
+
+#if CPU_JIT
+	Recompiler* recompiler = nullptr;	// Only allocated when enabled with setRecompiler()
+#endif
+
+#if CPU_FUSION
+	bool isFusionEnabled = true;
+#endif
+
+#if CPU_IDLE_SKIP
+	bool isIdleSkipEnabled = true;
+#endif
+
+private:
+#if CPU_BLOCK_CACHE
+	uint8_t blockIndex = 0;								// Index of the next instruction in the block
+	const BlockCache::cache_block_t* block = nullptr;	// Block being executed
+	const BlockCache::cache_uop_t* uop = nullptr;		// Predecoded instruction being executed (nullptr if it's read from the bus)
+#endif
+
+#if CPU_IDLE_SKIP
+	uint16_t loopStart = 0x0000;	// Target of the last backward JR taken
+#endif
+
+	/// ////////// ///
+	///	Cold state ///
+	/// ////////// ///
+
+	// Statistics, and state only used by rarely taken paths
+
+#if CPU_IDLE_SKIP
+	cpu_idle_loop_t idleLoop;		// Last loop analysed
+#endif
+
 public:
-	void connectBus(Bus* b);
+#if CPU_FUSION
+	uint64_t fusionCount[(uint8_t)cpu_fusion_t::count] = {};	// Number of times each fused sequence was run
+#endif
+
+#if CPU_IDLE_SKIP
+	uint64_t idleLoopsSkipped = 0;		// Number of times iterations of polling loops were skipped
+	uint64_t idleCyclesSkipped = 0;		// M-cycles skipped in polling loops
+#endif
+
+#if CPU_PAIR_HISTOGRAM
+	std::vector<uint64_t> pairHistogram = std::vector<uint64_t>(0x10000);	// Indexed by (previous opcode << 8) | opcode
+	uint8_t previousOpcode = 0x00;
+#endif
+
+#if DEBUG_HOOKS
+	DebugHooks* hooks = nullptr;
+#endif
+
+public:
+	~CPU();
+
+	void connectBus(Memory* b);
 	void reset();
 	void clock();
+	uint32_t step();
 
 	uint8_t getCycles() const;
 
+	// Write pending flags to F, to be called before reading registers.AF from outside of the CPU
+	void syncFlags();
+
+	void setBlockCache(bool enabled);
+	void setRecompiler(bool enabled);
+	void setFusion(bool enabled);
+	void setIdleSkip(bool enabled);
+	void setDebugHooks(DebugHooks* h);
+
+	void dumpFusions(std::ostream& os) const;
+
+	static const char* getDispatchName();
+	static const char* getTimingName();
+
 private:
+	static constexpr uint32_t maxSkip = 0x10000;	// M-cycles skipped at once when nothing bounds a halt or a polling loop
+
+#if CPU_JIT
+	uint8_t runCompiled();
+#endif
+
+#if CPU_FUSION
+	uint8_t runFused();
+	void nextFusedInstruction(uint8_t op);
+	template<uint8_t Op> uint8_t fusedDecJr();
+	uint8_t fusedCpJr();
+	uint8_t fusedLdhAluJr();
+	uint8_t fusedCopy();
+#endif
+
+	bool canInterrupt(uint8_t cycles);
+	uint32_t fastForwardHalt();
+
+#if CPU_IDLE_SKIP
+	uint32_t skipIdleLoop();
+	void analyseIdleLoop(uint32_t key);
+	bool isIdleLoopTaken(uint8_t value);
+#endif
+
 	void computeCycles();
 	void prepInstruction();
+	void fetch();
+	void execute();
 
 	uint8_t getFlag(cpu_flags_t f);
 	void setFlag(cpu_flags_t f, bool v);
 	void setFlags(bool z, bool n, bool h, bool c);
+	void recordFlags(cpu_lazy_op_t op, uint16_t a, uint16_t b, uint8_t c, uint8_t result);
+	uint8_t lazyCarry() const;
 
+	void tick();
 	uint8_t readBus(uint16_t addr);
 	void writeBus(uint16_t addr, uint8_t data);
+	uint8_t readPC();
 
 	bool handleInterrupt();
 
@@ -128,6 +303,41 @@ private:
 
 	void XXX(); void ILL();
 
+	/// ////////////// ///
+	///	ALU operations ///
+	/// ////////////// ///
+
+	void add8(uint8_t v); void adc8(uint8_t v);
+	void sub8(uint8_t v); void sbc8(uint8_t v);
+	void cp8(uint8_t v);
+	void and8(uint8_t v); void or8(uint8_t v); void xor8(uint8_t v);
+	uint8_t inc8(uint8_t v); uint8_t dec8(uint8_t v);
+	void add16(uint16_t v);
+
+	uint8_t rlc8(uint8_t v); uint8_t rl8(uint8_t v); uint8_t rrc8(uint8_t v); uint8_t rr8(uint8_t v);
+	uint8_t sla8(uint8_t v); uint8_t sra8(uint8_t v); uint8_t srl8(uint8_t v);
+	uint8_t swap8(uint8_t v);
+	void bit8(uint8_t v, uint8_t b);
+
+	/// ///////////////////////// ///
+	///	Specialized instructions  ///
+	/// ///////////////////////// ///
+
+	// Used by the switch dispatch, the operands are decoded from the opcode at compile time
+	// and [HL] operands are separate instantiations from register ones
+	template<uint8_t R> uint8_t& reg8();
+	template<uint8_t R> uint16_t& reg16();
+	template<uint8_t R> uint8_t readR8();
+	template<uint8_t R> void writeR8(uint8_t data);
+	template<uint8_t Alu> void alu8(uint8_t v);
+
+	template<uint8_t Op> void ldR8();	template<uint8_t Op> void ldR8N8();
+	template<uint8_t Op> void incR8();	template<uint8_t Op> void decR8();
+	template<uint8_t Op> void aluR8();	template<uint8_t Op> void aluN8();
+	template<uint8_t Op> void ldR16();	template<uint8_t Op> void addHL();
+	template<uint8_t Op> void incR16(); template<uint8_t Op> void decR16();
+	template<uint8_t Op> void prefixedOp();
+
 	/// ///////////// ///
 	///	Address masks ///
 	/// ///////////// ///
@@ -141,25 +351,28 @@ private:
 	/// ////////////////// ///
 	///	Instructions types ///
 	/// ////////////////// ///
+	// Tables are static constexpr so a single copy is shared by every CPU instance
+	// Fields omitted in the tables are zero-initialized
 	struct cpu_instruction_t {
-		std::string name;
-		void(CPU::*operate)(void) = nullptr;
-		void(CPU::*addrMode)(void) = nullptr;
-		uint8_t cycles = 0;
+		const char* name;
+		void(CPU::*operate)(void);
+		void(CPU::*addrMode)(void);
+		uint8_t cycles;
+		uint8_t cyclesBranch = 0;	// Cycles when the condition of a conditional instruction is fulfilled
 	};
 
 	struct cpu_prefixed_t {
-		std::string name;
-		void(CPU::* operate)(void) = nullptr;
-		uint8_t cycles = 0;
+		const char* name;
+		void(CPU::* operate)(void);
+		uint8_t cycles;
 	};
 
-	const cpu_instruction_t instructions[0x100] = {
+	static constexpr cpu_instruction_t instructions[0x100] = {
 /*		x0								  x1								x2								  x3								x4								  x5								x6								  x7								x8								  x9								xA								  xB								xC								  xD								xE								  xF								*/
 /* 0x */{"NOP", &CPU::NOP, &CPU::IMP, 1}, {"LD ", &CPU::L16, &CPU::N16, 3}, {"LD ", &CPU::LD8, &CPU::IAR, 2}, {"INC", &CPU::I16, &CPU::R16, 2}, {"INC", &CPU::INC, &CPU::MRG, 1}, {"DEC", &CPU::DEC, &CPU::MRG, 1}, {"LD ", &CPU::LD8, &CPU::NTR, 2}, {"RLCA",&CPU::RLCA,&CPU::REG, 1}, {"LD ", &CPU::LDS, &CPU::SAB, 5}, {"ADD", &CPU::A16, &CPU::RTH, 2}, {"LD ", &CPU::LD8, &CPU::IRA, 2}, {"DEC", &CPU::D16, &CPU::R16, 2}, {"INC", &CPU::INC, &CPU::MRG, 1}, {"DEC", &CPU::DEC, &CPU::MRG, 1}, {"LD ", &CPU::LD8, &CPU::NTR, 2}, {"RRCA",&CPU::RRCA,&CPU::REG, 1},
 /* 1x */{"STOP",&CPU::STP, &CPU::IMM, 2}, {"LD ", &CPU::L16, &CPU::N16, 3}, {"LD ", &CPU::LD8, &CPU::IAR, 2}, {"INC", &CPU::I16, &CPU::R16, 2}, {"INC", &CPU::INC, &CPU::MRG, 1}, {"DEC", &CPU::DEC, &CPU::MRG, 1}, {"LD ", &CPU::LD8, &CPU::NTR, 2}, {"RLA", &CPU::RLA, &CPU::REG, 1}, {"JR ", &CPU::_JR, &CPU::IMM, 3}, {"ADD", &CPU::A16, &CPU::RTH, 2}, {"LD ", &CPU::LD8, &CPU::IRA, 2}, {"DEC", &CPU::D16, &CPU::R16, 2}, {"INC", &CPU::INC, &CPU::MRG, 1}, {"DEC", &CPU::DEC, &CPU::MRG, 1}, {"LD ", &CPU::LD8, &CPU::NTR, 2}, {"RRA", &CPU::RRA, &CPU::REG, 1},
-/* 2x */{"JR ", &CPU::JRC, &CPU::IMM, 2}, {"LD ", &CPU::L16, &CPU::N16, 3}, {"LD ", &CPU::LD8, &CPU::IAR, 2}, {"INC", &CPU::I16, &CPU::R16, 2}, {"INC", &CPU::INC, &CPU::MRG, 1}, {"DEC", &CPU::DEC, &CPU::MRG, 1}, {"LD ", &CPU::LD8, &CPU::NTR, 2}, {"DAA", &CPU::DAA, &CPU::IMP, 1}, {"JR ", &CPU::JRC, &CPU::IMM, 2}, {"ADD", &CPU::A16, &CPU::RTH, 2}, {"LD ", &CPU::LD8, &CPU::IRA, 2}, {"DEC", &CPU::D16, &CPU::R16, 2}, {"INC", &CPU::INC, &CPU::MRG, 1}, {"DEC", &CPU::DEC, &CPU::MRG, 1}, {"LD ", &CPU::LD8, &CPU::NTR, 2}, {"CPL", &CPU::CPL, &CPU::IMP, 1},
-/* 3x */{"JR ", &CPU::JRC, &CPU::IMM, 2}, {"LD ", &CPU::L16, &CPU::N16, 3}, {"LD ", &CPU::LD8, &CPU::IAR, 2}, {"INC", &CPU::I16, &CPU::R16, 2}, {"INC", &CPU::INC, &CPU::MRG, 3}, {"DEC", &CPU::DEC, &CPU::MRG, 3}, {"LD ", &CPU::LD8, &CPU::NTH, 3}, {"SCF", &CPU::SCF, &CPU::IMP, 1}, {"JR ", &CPU::JRC, &CPU::IMM, 2}, {"ADD", &CPU::A16, &CPU::RTH, 2}, {"LD ", &CPU::LD8, &CPU::IRA, 2}, {"DEC", &CPU::D16, &CPU::R16, 2}, {"INC", &CPU::INC, &CPU::MRG, 1}, {"DEC", &CPU::DEC, &CPU::MRG, 1}, {"LD ", &CPU::LD8, &CPU::NTR, 2}, {"CCF", &CPU::CCF, &CPU::IMP, 1},
+/* 2x */{"JR ", &CPU::JRC, &CPU::IMM, 2, 3}, {"LD ", &CPU::L16, &CPU::N16, 3}, {"LD ", &CPU::LD8, &CPU::IAR, 2}, {"INC", &CPU::I16, &CPU::R16, 2}, {"INC", &CPU::INC, &CPU::MRG, 1}, {"DEC", &CPU::DEC, &CPU::MRG, 1}, {"LD ", &CPU::LD8, &CPU::NTR, 2}, {"DAA", &CPU::DAA, &CPU::IMP, 1}, {"JR ", &CPU::JRC, &CPU::IMM, 2, 3}, {"ADD", &CPU::A16, &CPU::RTH, 2}, {"LD ", &CPU::LD8, &CPU::IRA, 2}, {"DEC", &CPU::D16, &CPU::R16, 2}, {"INC", &CPU::INC, &CPU::MRG, 1}, {"DEC", &CPU::DEC, &CPU::MRG, 1}, {"LD ", &CPU::LD8, &CPU::NTR, 2}, {"CPL", &CPU::CPL, &CPU::IMP, 1},
+/* 3x */{"JR ", &CPU::JRC, &CPU::IMM, 2, 3}, {"LD ", &CPU::L16, &CPU::N16, 3}, {"LD ", &CPU::LD8, &CPU::IAR, 2}, {"INC", &CPU::I16, &CPU::R16, 2}, {"INC", &CPU::INC, &CPU::MRG, 3}, {"DEC", &CPU::DEC, &CPU::MRG, 3}, {"LD ", &CPU::LD8, &CPU::NTH, 3}, {"SCF", &CPU::SCF, &CPU::IMP, 1}, {"JR ", &CPU::JRC, &CPU::IMM, 2, 3}, {"ADD", &CPU::A16, &CPU::RTH, 2}, {"LD ", &CPU::LD8, &CPU::IRA, 2}, {"DEC", &CPU::D16, &CPU::R16, 2}, {"INC", &CPU::INC, &CPU::MRG, 1}, {"DEC", &CPU::DEC, &CPU::MRG, 1}, {"LD ", &CPU::LD8, &CPU::NTR, 2}, {"CCF", &CPU::CCF, &CPU::IMP, 1},
 /* 4x */{"LD ", &CPU::LD8, &CPU::RTR, 1}, {"LD ", &CPU::LD8, &CPU::RTR, 1}, {"LD ", &CPU::LD8, &CPU::RTR, 1}, {"LD ", &CPU::LD8, &CPU::RTR, 1}, {"LD ", &CPU::LD8, &CPU::RTR, 1}, {"LD ", &CPU::LD8, &CPU::RTR, 1}, {"LD ", &CPU::LD8, &CPU::HLR, 2}, {"LD ", &CPU::LD8, &CPU::RTR, 1}, {"LD ", &CPU::LD8, &CPU::RTR, 1}, {"LD ", &CPU::LD8, &CPU::RTR, 1}, {"LD ", &CPU::LD8, &CPU::RTR, 1}, {"LD ", &CPU::LD8, &CPU::RTR, 1}, {"LD ", &CPU::LD8, &CPU::RTR, 1}, {"LD ", &CPU::LD8, &CPU::RTR, 1}, {"LD ", &CPU::LD8, &CPU::HLR, 2}, {"LD ", &CPU::LD8, &CPU::RTR, 1},
 /* 5x */{"LD ", &CPU::LD8, &CPU::RTR, 1}, {"LD ", &CPU::LD8, &CPU::RTR, 1}, {"LD ", &CPU::LD8, &CPU::RTR, 1}, {"LD ", &CPU::LD8, &CPU::RTR, 1}, {"LD ", &CPU::LD8, &CPU::RTR, 1}, {"LD ", &CPU::LD8, &CPU::RTR, 1}, {"LD ", &CPU::LD8, &CPU::HLR, 2}, {"LD ", &CPU::LD8, &CPU::RTR, 1}, {"LD ", &CPU::LD8, &CPU::RTR, 1}, {"LD ", &CPU::LD8, &CPU::RTR, 1}, {"LD ", &CPU::LD8, &CPU::RTR, 1}, {"LD ", &CPU::LD8, &CPU::RTR, 1}, {"LD ", &CPU::LD8, &CPU::RTR, 1}, {"LD ", &CPU::LD8, &CPU::RTR, 1}, {"LD ", &CPU::LD8, &CPU::HLR, 2}, {"LD ", &CPU::LD8, &CPU::RTR, 1},
 /* 6x */{"LD ", &CPU::LD8, &CPU::RTR, 1}, {"LD ", &CPU::LD8, &CPU::RTR, 1}, {"LD ", &CPU::LD8, &CPU::RTR, 1}, {"LD ", &CPU::LD8, &CPU::RTR, 1}, {"LD ", &CPU::LD8, &CPU::RTR, 1}, {"LD ", &CPU::LD8, &CPU::RTR, 1}, {"LD ", &CPU::LD8, &CPU::HLR, 2}, {"LD ", &CPU::LD8, &CPU::RTR, 1}, {"LD ", &CPU::LD8, &CPU::RTR, 1}, {"LD ", &CPU::LD8, &CPU::RTR, 1}, {"LD ", &CPU::LD8, &CPU::RTR, 1}, {"LD ", &CPU::LD8, &CPU::RTR, 1}, {"LD ", &CPU::LD8, &CPU::RTR, 1}, {"LD ", &CPU::LD8, &CPU::RTR, 1}, {"LD ", &CPU::LD8, &CPU::HLR, 2}, {"LD ", &CPU::LD8, &CPU::RTR, 1},
@@ -168,13 +381,13 @@ private:
 /* 9x */{"SUB", &CPU::SUB, &CPU::REG, 1}, {"SUB", &CPU::SUB, &CPU::REG, 1}, {"SUB", &CPU::SUB, &CPU::REG, 1}, {"SUB", &CPU::SUB, &CPU::REG, 1}, {"SUB", &CPU::SUB, &CPU::REG, 1}, {"SUB", &CPU::SUB, &CPU::REG, 1}, {"SUB", &CPU::SUB, &CPU::REG, 2}, {"SUB", &CPU::SUB, &CPU::REG, 1}, {"SBC", &CPU::SBC, &CPU::REG, 1}, {"SBC", &CPU::SBC, &CPU::REG, 1}, {"SBC", &CPU::SBC, &CPU::REG, 1}, {"SBC", &CPU::SBC, &CPU::REG, 1}, {"SBC", &CPU::SBC, &CPU::REG, 1}, {"SBC", &CPU::SBC, &CPU::REG, 1}, {"SBC", &CPU::SBC, &CPU::REG, 2}, {"SBC", &CPU::SBC, &CPU::REG, 1},
 /* Ax */{"AND", &CPU::AND, &CPU::REG, 1}, {"AND", &CPU::AND, &CPU::REG, 1}, {"AND", &CPU::AND, &CPU::REG, 1}, {"AND", &CPU::AND, &CPU::REG, 1}, {"AND", &CPU::AND, &CPU::REG, 1}, {"AND", &CPU::AND, &CPU::REG, 1}, {"AND", &CPU::AND, &CPU::REG, 2}, {"AND", &CPU::AND, &CPU::REG, 1}, {"XOR", &CPU::XOR, &CPU::REG, 1}, {"XOR", &CPU::XOR, &CPU::REG, 1}, {"XOR", &CPU::XOR, &CPU::REG, 1}, {"XOR", &CPU::XOR, &CPU::REG, 1}, {"XOR", &CPU::XOR, &CPU::REG, 1}, {"XOR", &CPU::XOR, &CPU::REG, 1}, {"XOR", &CPU::XOR, &CPU::REG, 2}, {"XOR", &CPU::XOR, &CPU::REG, 1},
 /* Bx */{"OR ", &CPU::_OR, &CPU::REG, 1}, {"OR ", &CPU::_OR, &CPU::REG, 1}, {"OR ", &CPU::_OR, &CPU::REG, 1}, {"OR ", &CPU::_OR, &CPU::REG, 1}, {"OR ", &CPU::_OR, &CPU::REG, 1}, {"OR ", &CPU::_OR, &CPU::REG, 1}, {"OR ", &CPU::_OR, &CPU::REG, 2}, {"OR ", &CPU::_OR, &CPU::REG, 1}, {"CP ", &CPU::CMP, &CPU::REG, 1}, {"CP ", &CPU::CMP, &CPU::REG, 1}, {"CP ", &CPU::CMP, &CPU::REG, 1}, {"CP ", &CPU::CMP, &CPU::REG, 1}, {"CP ", &CPU::CMP, &CPU::REG, 1}, {"CP ", &CPU::CMP, &CPU::REG, 1}, {"CP ", &CPU::CMP, &CPU::REG, 2}, {"CP ", &CPU::CMP, &CPU::REG, 1},
-/* Cx */{"RET", &CPU::REC, &CPU::IMP, 2}, {"POP", &CPU::POP, &CPU::STR, 3}, {"JPC", &CPU::JPC, &CPU::IM6, 3}, {"JP ", &CPU::_JP, &CPU::IM6, 4}, {"CALL",&CPU::CLC, &CPU::IM6, 3}, {"PSH", &CPU::PSH, &CPU::RTS, 4}, {"ADD", &CPU::ADD, &CPU::IMM, 2}, {"RST", &CPU::RST, &CPU::IMP, 4}, {"RET", &CPU::REC, &CPU::IMP, 2}, {"RET", &CPU::RET, &CPU::IMP, 4}, {"JPC", &CPU::JPC, &CPU::IM6, 3}, {"PRE", &CPU::PRE, &CPU::IMP, 0}, {"CALL",&CPU::CLC, &CPU::IM6, 3}, {"CALL",&CPU::CLL, &CPU::IM6, 6}, {"ADC", &CPU::ADC, &CPU::IMM, 2}, {"RST", &CPU::RST, &CPU::IMP, 4},
-/* Dx */{"RET", &CPU::REC, &CPU::IMP, 2}, {"POP", &CPU::POP, &CPU::STR, 3}, {"JPC", &CPU::JPC, &CPU::IM6, 3}, {"ILL", &CPU::ILL, &CPU::IMP, 1}, {"CALL",&CPU::CLC, &CPU::IM6, 3}, {"PSH", &CPU::PSH, &CPU::RTS, 4}, {"SUB", &CPU::SUB, &CPU::IMM, 2}, {"RST", &CPU::RST, &CPU::IMP, 4}, {"RET", &CPU::REC, &CPU::IMP, 2}, {"RETI",&CPU::REI, &CPU::IMP, 4}, {"JPC", &CPU::JPC, &CPU::IM6, 3}, {"ILL", &CPU::ILL, &CPU::IMP, 1}, {"CALL",&CPU::CLC, &CPU::IM6, 3}, {"ILL", &CPU::ILL, &CPU::IMP, 1}, {"SBC", &CPU::SBC, &CPU::IMM, 2}, {"RST", &CPU::RST, &CPU::IMP, 4},
+/* Cx */{"RET", &CPU::REC, &CPU::IMP, 2, 5}, {"POP", &CPU::POP, &CPU::STR, 3}, {"JPC", &CPU::JPC, &CPU::IM6, 3, 4}, {"JP ", &CPU::_JP, &CPU::IM6, 4}, {"CALL",&CPU::CLC, &CPU::IM6, 3, 6}, {"PSH", &CPU::PSH, &CPU::RTS, 4}, {"ADD", &CPU::ADD, &CPU::IMM, 2}, {"RST", &CPU::RST, &CPU::IMP, 4}, {"RET", &CPU::REC, &CPU::IMP, 2, 5}, {"RET", &CPU::RET, &CPU::IMP, 4}, {"JPC", &CPU::JPC, &CPU::IM6, 3, 4}, {"PRE", &CPU::PRE, &CPU::IMP, 0}, {"CALL",&CPU::CLC, &CPU::IM6, 3, 6}, {"CALL",&CPU::CLL, &CPU::IM6, 6}, {"ADC", &CPU::ADC, &CPU::IMM, 2}, {"RST", &CPU::RST, &CPU::IMP, 4},
+/* Dx */{"RET", &CPU::REC, &CPU::IMP, 2, 5}, {"POP", &CPU::POP, &CPU::STR, 3}, {"JPC", &CPU::JPC, &CPU::IM6, 3, 4}, {"ILL", &CPU::ILL, &CPU::IMP, 1}, {"CALL",&CPU::CLC, &CPU::IM6, 3, 6}, {"PSH", &CPU::PSH, &CPU::RTS, 4}, {"SUB", &CPU::SUB, &CPU::IMM, 2}, {"RST", &CPU::RST, &CPU::IMP, 4}, {"RET", &CPU::REC, &CPU::IMP, 2, 5}, {"RETI",&CPU::REI, &CPU::IMP, 4}, {"JPC", &CPU::JPC, &CPU::IM6, 3, 4}, {"ILL", &CPU::ILL, &CPU::IMP, 1}, {"CALL",&CPU::CLC, &CPU::IM6, 3, 6}, {"ILL", &CPU::ILL, &CPU::IMP, 1}, {"SBC", &CPU::SBC, &CPU::IMM, 2}, {"RST", &CPU::RST, &CPU::IMP, 4},
 /* Ex */{"LD ", &CPU::LD8, &CPU::AA8, 3}, {"POP", &CPU::POP, &CPU::STR, 3}, {"LD ", &CPU::LD8, &CPU::IAC, 2}, {"ILL", &CPU::ILL, &CPU::IMP, 1}, {"ILL", &CPU::ILL, &CPU::IMP, 1}, {"PSH", &CPU::PSH, &CPU::RTS, 4}, {"AND", &CPU::AND, &CPU::IMM, 2}, {"RST", &CPU::RST, &CPU::IMP, 4}, {"ADD", &CPU::ASP, &CPU::IMM, 4}, {"JP ", &CPU::JPH, &CPU::IMP, 1}, {"LD ", &CPU::LD8, &CPU::AAB, 4}, {"ILL", &CPU::ILL, &CPU::IMP, 1}, {"ILL", &CPU::ILL, &CPU::IMP, 1}, {"ILL", &CPU::ILL, &CPU::IMP, 1}, {"XOR", &CPU::XOR, &CPU::IMM, 2}, {"RST", &CPU::RST, &CPU::IMP, 4},
 /* Fx */{"LD ", &CPU::LD8, &CPU::A8A, 3}, {"POP", &CPU::POP, &CPU::STR, 3}, {"LD ", &CPU::LD8, &CPU::ICA, 2}, {"DI ", &CPU::_DI, &CPU::IMP, 1}, {"ILL", &CPU::ILL, &CPU::IMP, 1}, {"PSH", &CPU::PSH, &CPU::RTS, 4}, {"OR ", &CPU::_OR, &CPU::IMM, 2}, {"RST", &CPU::RST, &CPU::IMP, 4}, {"LD ", &CPU::LHS, &CPU::STH, 3}, {"LD ", &CPU::L16, &CPU::HTS, 2}, {"LD ", &CPU::LD8, &CPU::ABA, 4}, {"EI ", &CPU::_EI, &CPU::IMP, 1}, {"ILL", &CPU::ILL, &CPU::IMP, 1}, {"ILL", &CPU::ILL, &CPU::IMP, 1}, {"CP ", &CPU::CMP, &CPU::IMM, 2}, {"RST", &CPU::RST, &CPU::IMP, 4}
 	};
 
-	const cpu_prefixed_t prefixed[0x100] = {
+	static constexpr cpu_prefixed_t prefixed[0x100] = {
 /*		x0					   x1					  x2					 x3						x4					   x5					  x6					 x7						x8					   x9					  xA					 xB					    xC					   xD					  xE					 xF						*/
 /* 0x */{"RLC", &CPU::RLC, 2}, {"RLC", &CPU::RLC, 2}, {"RLC", &CPU::RLC, 2}, {"RLC", &CPU::RLC, 2}, {"RLC", &CPU::RLC, 2}, {"RLC", &CPU::RLC, 2}, {"RLC", &CPU::RLC, 4}, {"RLC", &CPU::RLC, 2}, {"RRC", &CPU::RRC, 2}, {"RRC", &CPU::RRC, 2}, {"RRC", &CPU::RRC, 2}, {"RRC", &CPU::RRC, 2}, {"RRC", &CPU::RRC, 2}, {"RRC", &CPU::RRC, 2}, {"RRC", &CPU::RRC, 4}, {"RRC", &CPU::RRC, 2},
 /* 1x */{"RL ", &CPU::_RL, 2}, {"RL ", &CPU::_RL, 2}, {"RL ", &CPU::_RL, 2}, {"RL ", &CPU::_RL, 2}, {"RL ", &CPU::_RL, 2}, {"RL ", &CPU::_RL, 2}, {"RL ", &CPU::_RL, 4}, {"RL ", &CPU::_RL, 2}, {"RR ", &CPU::_RR, 2}, {"RR ", &CPU::_RR, 2}, {"RR ", &CPU::_RR, 2}, {"RR ", &CPU::_RR, 2}, {"RR ", &CPU::_RR, 2}, {"RR ", &CPU::_RR, 2}, {"RR ", &CPU::_RR, 4}, {"RR ", &CPU::_RR, 2},
@@ -1,84 +1,349 @@
 #include "Cartridge.h"
 
+#include <filesystem>
+
+RomCache Cartridge::romCache;
+
 Cartridge::Cartridge(std::string filename) {
-	std::ifstream ifs;
-	ifs.open(filename.c_str(), std::ifstream::binary);
+	image = romCache.acquire(filename, isHeaderValid);
 
-	if (!ifs.is_open()) {
-		std::cout << "Failed to open file: " << filename << std::endl;
+	if (!image) {
 		return;
 	}
 
-	ifs.seekg(0, ifs.end);
-	rom_size = (uint32_t)ifs.tellg();
-	ifs.seekg(0, ifs.beg);
+	rom_data = image->data;
+	rom_size = image->size;
 
-	rom_data = new uint8_t[rom_size];
+	header = (const cart_header_t*)(rom_data + 0x0100);
 
-	if (!rom_data) {
-		std::cout << "Failed to load rom in memory: " << filename << std::endl;
-		return;
+	cart_info_t info;
+	parseHeader(rom_data, rom_size, info);
+
+	std::cout << "Cartridge loaded:" << std::endl;
+	std::cout << "\tTitle:\t\t" << info.title << std::endl;
+	std::cout << "\tLiscence:\t" << info.licensee << std::endl;
+	std::cout << "\tType:\t\t" << info.typeName << std::endl;
+	std::cout << "\tROM size:\t" << (info.romSize / 1024) << " KB (Loaded:\t" << (rom_size / 1024) << " KB)" << std::endl;
+	std::cout << "\tRAM size:\t" << (info.ramSize / 1024) << " KB" << std::endl;
+	std::cout << "\tVersion:\t" << (int)info.version << std::endl;
+
+	std::cout << "\tChecksum:\t" 
+		<< (info.isHeaderChecksumValid ? "PASSED" : "FAILED") 
+		<< " - 0x" 
+		<< std::hex << std::uppercase << std::setw(2) << std::setfill('0') << (int)info.headerChecksum << " (0x" << (int)header->checksum << ")"
+		<< std::dec << std::endl << std::endl;
+
+	mapper = info.mapper;
+
+	if (mapper == romOnly && info.type != 0x00 && info.type != 0x08 && info.type != 0x09) {
+		std::cout << "Cartridge type not supported, running as ROM only." << std::endl;
 	}
 
-	ifs.read((char *)rom_data, rom_size);
-	ifs.close();
+	rom_banks = (uint16_t)std::max<uint32_t>(2, (rom_size + 0x3FFF) >> 14);
 
-	if (rom_size < 0x014F) {
-		std::cout << "ROM non valid." << std::endl;
-		return;
+	// External RAM (at least a whole bank so the RAM window can be mapped, even for 2 KiB RAM)
+	if (info.ramSize) {
+		ram_size = std::max<uint32_t>(0x2000, info.ramSize);
+		ram_banks = (uint8_t)(ram_size >> 13);
 	}
 
-	header = (cart_header_t*)(rom_data + 0x0100);
+	if (info.hasRtc) {
+		rtc = new RealTimeClock();
+	}
 
-	std::cout << "Cartridge loaded:" << std::endl;
-	std::cout << "\tTitle:\t\t" << header->title << std::endl;	
-	std::cout << "\tLiscence:\t"
-		<< (header->license_code == 0x33 ? new_licence_table[header->new_license_code & 0xFF] : old_licence_table[header->license_code])
-		<< std::endl;
-	std::cout << "\tType:\t\t" << type_table[header->type] << std::endl;
-	std::cout << "\tROM size:\t" << (int)(32 * (1 << header->rom_size)) << " KB (Loaded:\t" << (rom_size / 1024) << " KB)" << std::endl;
-	std::cout << "\tRAM size:\t" << std::hex << std::uppercase << (int)header->ram_size << std::endl;
-	std::cout << "\tVersion:\t" << (int)header->ram_size << std::endl;
+	// Battery-backed RAM and clock are saved next to the ROM, the clock after the RAM
+	if (info.hasBattery && (ram_size || rtc)) {
+		save = new SaveRam(std::filesystem::path(filename).replace_extension(".sav").string(), ram_size);
+		ram_data = ram_size ? save->data : nullptr;
 
-	uint8_t checksum = 0;
-	for (uint16_t i = 0x0134; i <= 0x014C; i++) {
-		checksum = checksum - rom_data[i] - 1;
+		if (rtc) {
+			rtc->load(save->getTrailer().data(), (uint32_t)save->getTrailer().size());
+		}
 	}
+	else if (ram_size) {
+		ram_data = new uint8_t[ram_size];
 
-	std::cout << "\tChecksum:\t" 
-		<< (((checksum & 0xFF) == header->checksum) ? "PASSED" : "FAILED") 
-		<< " - 0x" 
-		<< std::hex << std::uppercase << std::setw(2) << std::setfill('0') << (int)checksum << " (0x" << (int)header->checksum << ")" << std::endl << std::endl;
+		for (uint32_t i = 0; i < ram_size; i++) {
+			ram_data[i] = 0x00;
+		}
+	}
+
+	isRamEnabled = mapper == romOnly;	// ROM+RAM cartridges have no register to enable the RAM
+	updateBanks();
 
 	isLoaded = true;
 }
 
 Cartridge::~Cartridge() {
-	delete[] rom_data;
+	if (image) {
+		romCache.release(image);
+	}
+
+	if (save) {
+		if (rtc) {
+			uint8_t trailer[RealTimeClock::trailerSize];
+			rtc->save(trailer);
+			save->setTrailer(trailer, sizeof(trailer));
+		}
+
+		delete save;	// Owns the RAM
+	}
+	else {
+		delete[] ram_data;
+	}
+
+	delete rtc;
 }
 
-uint8_t Cartridge::read(uint16_t addr) {
-	if (addr >= 0x0000 && addr <= 0x3FFF) {			// ROM Bank 00
-		return rom_data[addr];
+// Decode the header of a ROM from its first bytes (at least 0x0150) without any side effect
+// Returns false if the header is not valid, 'info' is left unset then
+bool Cartridge::parseHeader(const uint8_t* data, uint32_t size, cart_info_t& info) {
+	if (!isHeaderValid(data, size)) {
+		return false;
+	}
+
+	const cart_header_t* h = (const cart_header_t*)(data + 0x0100);
+
+	bool isEnd = false;
+	for (uint8_t i = 0; i < sizeof(info.title); i++) {
+		isEnd = isEnd || i >= sizeof(h->title) || !h->title[i];
+		info.title[i] = isEnd ? '\0' : h->title[i];
+	}
+
+	info.licensee = h->license_code == 0x33 ? new_licence_table[h->new_license_code & 0xFF] : old_licence_table[h->license_code];
+	info.typeName = type_table[h->type];
+	info.type = h->type;
+
+	if (h->type >= 0x01 && h->type <= 0x03) {
+		info.mapper = mbc1;
+	}
+	else if (h->type >= 0x0F && h->type <= 0x13) {
+		info.mapper = mbc3;
+	}
+	else if (h->type >= 0x19 && h->type <= 0x1E) {
+		info.mapper = mbc5;
+	}
+	else {
+		info.mapper = romOnly;
+	}
+
+	info.romSize = 0x8000 << h->rom_size;
+	info.ramSize = h->ram_size < 0x06 ? ram_size_table[h->ram_size] : 0;
+
+	switch (h->type) {
+	case 0x03: case 0x06: case 0x09: case 0x0D: case 0x0F: case 0x10: case 0x13: case 0x1B: case 0x1E: case 0x22:
+		info.hasBattery = true;
+		break;
+	default:
+		info.hasBattery = false;
+		break;
 	}
-	else if (addr >= 0x4000 && addr <= 0x7FFF) {	// ROM Switchable bank via mapper
-		return rom_data[addr];
+
+	info.hasRtc = h->type == 0x0F || h->type == 0x10;
+	info.version = h->version;
+
+	info.headerChecksum = 0;
+	for (uint16_t addr = 0x0134; addr <= 0x014C; addr++) {
+		info.headerChecksum = info.headerChecksum - data[addr] - 1;
 	}
-	else if (addr >= 0xA000 && addr <= 0xBFFF) {	// RAM switchable bank
-		// TODO (not supported yet)
+
+	info.isHeaderChecksumValid = info.headerChecksum == h->checksum;
+	info.globalChecksum = (data[0x014E] << 8) | data[0x014F];	// Big-endian
+
+	return true;
+}
+
+// Check the header before using it, it's only read from the first page of the ROM
+bool Cartridge::isHeaderValid(const uint8_t* data, uint32_t size) {
+	if (size < 0x0150) {	// Header ends at 0x014F
+		return false;
+	}
+
+	const cart_header_t* h = (const cart_header_t*)(data + 0x0100);
+
+	return h->type < 0x23 && h->rom_size <= 0x08;	// Known cartridge type and ROM size (up to 8 MiB)
+}
+
+uint8_t Cartridge::read(uint16_t addr) {
+	if (addr >= 0x0000 && addr <= 0x7FFF) {			// ROM Bank 00 / ROM Switchable bank via mapper
+		uint32_t offset = (addr <= 0x3FFF ? banks.rom0Offset : banks.romXOffset) | (addr & 0x3FFF);
+
+		return offset < rom_size ? rom_data[offset] : 0xFF;	// Past the end of the ROM
+	}
+	else if (addr >= 0xA000 && addr <= 0xBFFF) {	// RAM switchable bank or MBC3 clock register
+		if (banks.ramWindow) {
+			return banks.ramWindow[addr - 0xA000];
+		}
+
+		return isRtcSelected() ? rtc->read(ramBankRegister) : 0xFF;
 	}
 
 	return 0x00;
 }
 
-void Cartridge::write(uint16_t addr, uint8_t data) {
-	if (addr >= 0x0000 && addr <= 0x3FFF) {			// ROM Bank 00
-		// ROM - not supposed to be writable
+// Write to the mapper registers (0x0000 - 0x7FFF) or the cartridge RAM, returns whether the mapped banks changed
+bool Cartridge::write(uint16_t addr, uint8_t data) {
+	if (addr >= 0xA000 && addr <= 0xBFFF) {			// RAM switchable bank
+		if (banks.ramWindow) {
+			banks.ramWindow[addr - 0xA000] = data;
+
+			// First write to a clean page of a saved RAM, the bus can now write to that page directly
+			if (save && save->markDirty((uint32_t)(banks.ramWindow - ram_data) + (addr - 0xA000))) {
+				return true;
+			}
+		}
+		else if (isRtcSelected()) {
+			rtc->write(ramBankRegister, data);
+		}
+		return false;
+	}
+	else if (addr > 0x7FFF) {
+		return false;
+	}
+
+	switch (mapper)
+	{
+	case mbc1:
+		if (addr <= 0x1FFF) {						// RAM enable
+			isRamEnabled = (data & 0x0F) == 0x0A;
+		}
+		else if (addr <= 0x3FFF) {					// ROM bank (5 bits, 0 is read as 1)
+			romBankRegister = (data & 0x1F) ? (data & 0x1F) : 0x01;
+		}
+		else if (addr <= 0x5FFF) {					// RAM bank or upper ROM bank bits
+			ramBankRegister = data & 0x03;
+		}
+		else {										// Banking mode
+			bankingMode = data & 0x01;
+		}
+		break;
+
+	case mbc3:
+		if (addr <= 0x1FFF) {						// RAM and RTC enable
+			isRamEnabled = (data & 0x0F) == 0x0A;
+		}
+		else if (addr <= 0x3FFF) {					// ROM bank (7 bits, 0 is read as 1)
+			romBankRegister = (data & 0x7F) ? (data & 0x7F) : 0x01;
+		}
+		else if (addr <= 0x5FFF) {					// RAM bank (0x00 - 0x03) or RTC register (0x08 - 0x0C)
+			ramBankRegister = data & 0x0F;
+		}
+		else {										// Latch clock data
+			if (rtc && latchRegister == 0x00 && data == 0x01) {
+				rtc->latch();
+			}
+			latchRegister = data;
+		}
+		break;
+
+	case mbc5:
+		if (addr <= 0x1FFF) {						// RAM enable
+			isRamEnabled = data == 0x0A;
+		}
+		else if (addr <= 0x2FFF) {					// ROM bank (lower 8 bits, 0 is a valid bank)
+			romBankRegister = (romBankRegister & 0x100) | data;
+		}
+		else if (addr <= 0x3FFF) {					// ROM bank (9th bit)
+			romBankRegister = (romBankRegister & 0xFF) | ((data & 0x01) << 8);
+		}
+		else if (addr <= 0x5FFF) {					// RAM bank
+			ramBankRegister = data & 0x0F;
+		}
+		break;
+
+	default:										// ROM - not supposed to be writable
+		return false;
+	}
+
+	return updateBanks();
+}
+
+// Sum of every byte of the ROM but the global checksum itself, to be compared to the one in the header
+uint16_t Cartridge::computeGlobalChecksum(const uint8_t* data, uint32_t size) {
+	uint16_t checksum = 0;
+
+	for (uint32_t i = 0; i < size; i++) {
+		checksum += data[i];
+	}
+
+	return checksum - (size >= 0x0150 ? data[0x014E] + data[0x014F] : 0);
+}
+
+// ROM bank mapped at an address of the cartridge ROM (0x0000 - 0x7FFF)
+uint16_t Cartridge::getRomBank(uint16_t addr) const {
+	return addr <= 0x3FFF ? banks.rom0 : banks.romX;
+}
+
+// ROM data of the 256-byte page mapped at an address of the ROM area (nullptr if it's past the end of the ROM)
+const uint8_t* Cartridge::getRomPage(uint16_t addr) const {
+	uint32_t offset = (addr <= 0x3FFF ? banks.rom0Offset : banks.romXOffset) | (addr & 0x3F00);
+
+	return offset + 0x100 <= rom_size ? rom_data + offset : nullptr;
+}
+
+// RAM of the 256-byte page mapped at an address of the RAM area (0xA000 - 0xBFFF), to be written by the bus directly
+// nullptr if RAM is disabled, or for a clean page of a saved RAM so its first write goes to write() and marks it dirty
+uint8_t* Cartridge::getRamWritePage(uint16_t addr) const {
+	if (!banks.ramWindow) {
+		return nullptr;
 	}
-	else if (addr >= 0x4000 && addr <= 0x7FFF) {	// ROM Switchable bank via mapper
-		// ROM - not supposed to be writable
+
+	uint32_t offset = (uint32_t)(banks.ramWindow - ram_data) + (addr & 0x1F00);
+
+	return !save || save->isPageDirty(offset) ? ram_data + offset : nullptr;
+}
+
+// Hand the RAM written since the last commit to the save writer, returns true if the RAM pages have to be remapped
+// (they are clean again)
+bool Cartridge::commitSave() {
+	if (!save) {
+		return false;
+	}
+
+	// Clock is saved along with the RAM, or when its registers have been written
+	if (rtc && (rtc->isChanged || save->hasChanges())) {
+		uint8_t trailer[RealTimeClock::trailerSize];
+		rtc->save(trailer);
+		save->setTrailer(trailer, sizeof(trailer));
 	}
-	else if (addr >= 0xA000 && addr <= 0xBFFF) {	// RAM switchable bank
-		// TODO (not supported yet)
+
+	return save->commit();
+}
+
+// Select the banks from the mapper registers and compute where they are in memory, so the accesses don't have to
+// Returns whether the mapping changed
+bool Cartridge::updateBanks() {
+	cart_banks_t previous = banks;
+
+	switch (mapper)
+	{
+	case mbc1:
+		// Upper bits select the ROM bank (large ROMs) and, in mode 1, the ROM bank 00 area and the RAM bank (large RAMs)
+		banks.romX = ((ramBankRegister << 5) | romBankRegister) % rom_banks;
+		banks.rom0 = bankingMode ? (ramBankRegister << 5) % rom_banks : 0;
+		banks.ram = bankingMode && ram_banks ? ramBankRegister % ram_banks : 0;
+		break;
+
+	case mbc3:
+		banks.romX = romBankRegister % rom_banks;
+		banks.ram = ramBankRegister < 0x08 && ram_banks ? ramBankRegister % ram_banks : ramBankRegister;	// 0x08 - 0x0C select the RTC
+		break;
+
+	case mbc5:
+		banks.romX = romBankRegister % rom_banks;
+		banks.ram = ram_banks ? ramBankRegister % ram_banks : 0;
+		break;
+
+	default:
+		break;
 	}
-}
\ No newline at end of file
+
+	banks.rom0Offset = (uint32_t)banks.rom0 << 14;
+	banks.romXOffset = (uint32_t)banks.romX << 14;
+
+	// MBC3 RTC registers are not mapped to memory
+	bool isRamMapped = isRamEnabled && ram_data && banks.ram < ram_banks;
+	banks.ramWindow = isRamMapped ? ram_data + ((uint32_t)banks.ram << 13) : nullptr;
+
+	return banks.rom0Offset != previous.rom0Offset || banks.romXOffset != previous.romXOffset || banks.ramWindow != previous.ramWindow;
+}
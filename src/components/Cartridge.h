@@ -2,10 +2,15 @@
 
 #include <cstdint>
 #include <string>
+#include <algorithm>
 #include <iostream>
 #include <iomanip>
 #include <fstream> 
 
+#include "RealTimeClock.h"
+#include "RomCache.h"
+#include "SaveRam.h"
+
 class Cartridge
 {
 private:
@@ -25,23 +30,95 @@ private:
         uint8_t version;            // Addresse 0x014C
         uint8_t checksum;           // Addresse 0x014D
         uint16_t global_checksum;   // Addresse 0x014E - 0x014D
-    } *header = nullptr;
+    } const *header = nullptr;
 
+    const RomImage* image = nullptr;    // Shared with the other cartridges running the same ROM
     uint32_t rom_size = 0;
-    uint8_t* rom_data = nullptr;
+    const uint8_t* rom_data = nullptr;
+    uint16_t rom_banks = 2;     // 16 KiB banks
+
+    uint32_t ram_size = 0;
+    uint8_t* ram_data = nullptr;
+    uint8_t ram_banks = 0;      // 8 KiB banks
 
 public:
+    enum cart_mapper_t : uint8_t {
+        romOnly,
+        mbc1,
+        mbc3,
+        mbc5
+    };
+
+    // Banks selected by the mapper and where they are in host memory
+    // They are only recomputed when a mapper register is written, so the bus can cache them in its page tables
+    struct cart_banks_t {
+        uint16_t rom0 = 0;              // ROM bank at 0x0000 - 0x3FFF
+        uint16_t romX = 1;              // ROM bank at 0x4000 - 0x7FFF
+        uint8_t ram = 0;                // RAM bank at 0xA000 - 0xBFFF
+        uint32_t rom0Offset = 0x0000;   // Offsets of the ROM banks in the ROM data
+        uint32_t romXOffset = 0x4000;
+        uint8_t* ramWindow = nullptr;   // RAM bank data, nullptr if RAM is disabled or missing
+    } banks;
+
+    cart_mapper_t mapper = romOnly;
     bool isLoaded = false;
 
+    SaveRam* save = nullptr;            // Battery-backed RAM and clock, saved next to the ROM (nullptr without battery)
+    RealTimeClock* rtc = nullptr;       // MBC3 clock (nullptr without timer)
+    static constexpr uint32_t saveCommitPeriod = 17556;    // M-cycles between two commits of the saved RAM (one frame)
+
+    static RomCache romCache;
+
+    // Header fields, decoded without loading the cartridge (see parseHeader())
+    struct cart_info_t {
+        char title[0x10];               // Null-terminated
+        const char* licensee;
+        const char* typeName;
+        uint8_t type;
+        cart_mapper_t mapper;
+        uint32_t romSize;               // Declared sizes in bytes
+        uint32_t ramSize;
+        bool hasBattery;
+        bool hasRtc;
+        uint8_t version;
+        uint8_t headerChecksum;         // Computed over 0x0134 - 0x014C
+        bool isHeaderChecksumValid;
+        uint16_t globalChecksum;        // Declared (see computeGlobalChecksum())
+    };
+
+private:
+    // Mapper registers
+    bool isRamEnabled = false;
+    uint16_t romBankRegister = 0x0001;  // Lower ROM bank bits for MBC1
+    uint8_t ramBankRegister = 0x00;     // Upper ROM bank bits for MBC1, RTC register for MBC3 (0x08 - 0x0C)
+    uint8_t bankingMode = 0x00;         // MBC1 only
+    uint8_t latchRegister = 0xFF;       // MBC3 only, the clock is latched by writing 0x00 then 0x01
+
 public:
     Cartridge(std::string filename);
     ~Cartridge();
 
     uint8_t read(uint16_t addr);
-    void write(uint16_t addr, uint8_t data);
+    bool write(uint16_t addr, uint8_t data);
+
+    uint16_t getRomBank(uint16_t addr) const;
+    const uint8_t* getRomPage(uint16_t addr) const;
+    uint8_t* getRamWritePage(uint16_t addr) const;
+
+    bool commitSave();
+
+    static bool parseHeader(const uint8_t* data, uint32_t size, cart_info_t& info);
+    static bool isHeaderValid(const uint8_t* data, uint32_t size);
+    static uint16_t computeGlobalChecksum(const uint8_t* data, uint32_t size);
 
 private:
-    const char* type_table[0x23] = {
+
+    bool updateBanks();
+    bool isRtcSelected() const { return rtc && isRamEnabled && ramBankRegister >= 0x08 && ramBankRegister <= 0x0C; }
+
+    // Lookup tables are static so a single copy is shared by every cartridge
+    static constexpr uint32_t ram_size_table[0x06] = { 0, 0x800, 0x2000, 0x8000, 0x20000, 0x10000 };
+    static constexpr const char* type_table[0x23] = {
         "ROM ONLY",                         // 0x00
         "MBC1",                             // 0x01
         "MBC1+RAM",                         // 0x02
@@ -79,7 +156,7 @@ private:
         "MBC7+SENSOR+RUMBLE+RAM+BATTERY"    // 0x22
     };
     //TODO: Expand new_licence 0x10000 and correct Cartridge header to unbound to 0xFF (temoporary fix)
-    const char* new_licence_table[0x100] = {
+    static constexpr const char* new_licence_table[0x100] = {
         "None",                                 // 0x00
         "Nintendo Research & Development 1",    // 0x01
         "None",                                 // 0x02
@@ -337,7 +414,7 @@ private:
         "None",                                 // 0xFE
         "None"                                  // 0xFF
     }; 
-    const char* old_licence_table[0x100] = {
+    static constexpr const char* old_licence_table[0x100] = {
         "None",                     // 0x00
         "Nintendo",                 // 0x01
         "None",                     // 0x02
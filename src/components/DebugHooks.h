@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+
+#include "InterruptController.h"
+
+// Callbacks a CPU calls for debugging tools (tracers, breakpoints, loggers), only compiled in with DEBUG_HOOKS
+// Callbacks left to nullptr are not called, 'context' is passed back to each of them
+// Fusion, polling loops skipping and the recompiler run several instructions at once without retiring them one by one,
+// they have to be disabled to see every instruction
+struct DebugHooks {
+	void* context = nullptr;
+
+	void(*onExecute)(void* context, uint16_t pc, uint8_t opcode) = nullptr;	// Instruction at pc about to be executed, registers not modified yet
+	void(*onRetire)(void* context, uint16_t pc, uint8_t opcode) = nullptr;		// Instruction at pc executed (0xCB for prefixed ones)
+	void(*onRead)(void* context, uint16_t addr, uint8_t data) = nullptr;		// Bus read by an instruction
+	void(*onWrite)(void* context, uint16_t addr, uint8_t data) = nullptr;		// Bus write by an instruction
+	void(*onInterrupt)(void* context, InterruptController::interrupt_source_t source, uint16_t vector) = nullptr;
+	void(*onUnsupported)(void* context, uint16_t pc, uint8_t opcode) = nullptr;	// Illegal or not supported opcode
+};
@@ -0,0 +1,35 @@
+#include "FlatMemory.h"
+
+#include <fstream>
+#include <iostream>
+
+FlatMemory::FlatMemory() {
+	for (uint32_t i = 0; i < 0x10000; i++) {
+		memory[i] = 0x00;
+	}
+}
+
+FlatMemory::~FlatMemory() {
+
+}
+
+void FlatMemory::connectCPU(CPU<FlatMemory>* c) {
+	cpu = c;
+	cpu->connectBus(this);
+}
+
+// Copy a file at address 0x0000 (up to 64 KiB), return false if it can't be read
+bool FlatMemory::load(const std::string& filename) {
+	std::ifstream ifs;
+	ifs.open(filename.c_str(), std::ifstream::binary);
+
+	if (!ifs.is_open()) {
+		std::cout << "Failed to open file: " << filename << std::endl;
+		return false;
+	}
+
+	ifs.read((char *)memory, sizeof(memory));
+	ifs.close();
+
+	return true;
+}
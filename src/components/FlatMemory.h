@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "CPU.h"
+#include "InterruptController.h"
+
+// Plain 64 KiB of RAM for test harnesses (instruction test vectors, fuzzing)
+// No other component is connected: reads and writes are direct array accesses, and no interrupt is ever requested
+class FlatMemory
+{
+public:
+	static constexpr bool hasRom = false;	// Every address is writable, code can change anywhere
+
+	InterruptController interrupts;
+	CPU<FlatMemory>* cpu = nullptr;
+
+	uint8_t memory[0x10000];
+
+	uint64_t clockCounter = 0;
+
+public:
+	FlatMemory();
+	~FlatMemory();
+
+	void connectCPU(CPU<FlatMemory>* c);
+	bool load(const std::string& filename);
+
+	uint8_t read(uint16_t addr) const { return memory[addr]; }
+	void write(uint16_t addr, uint8_t data) { memory[addr] = data; }
+
+	void advance(uint8_t cycles) { clockCounter += cycles; }
+	void fastForward(uint32_t cycles) { clockCounter += cycles; }
+
+	uint32_t getCyclesToChange(uint16_t) const { return UINT32_MAX; }
+	uint32_t getCyclesToInterrupt() const { return UINT32_MAX; }
+	uint16_t getRomBank(uint16_t) const { return 0x0000; }
+	void setStopped(bool) {}
+};
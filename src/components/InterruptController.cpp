@@ -0,0 +1,52 @@
+#include "InterruptController.h"
+
+InterruptController::InterruptController() {
+
+}
+
+InterruptController::~InterruptController() {
+
+}
+
+// Set the flag of the source in the IF Register
+void InterruptController::request(interrupt_source_t source) {
+	flags |= 1 << source;
+	update();
+}
+
+// Reset the flag of the dispatched source in the IF Register, and IME so no other interrupt take over
+// (unless IME flag is manually set back)
+void InterruptController::acknowledge(interrupt_source_t source) {
+	flags &= ~(1 << source);
+	IME = false;
+
+	update();
+}
+
+void InterruptController::setFlags(uint8_t data) {
+	flags = data;
+	update();
+}
+
+void InterruptController::setEnable(uint8_t data) {
+	enable = data;
+	update();
+}
+
+void InterruptController::setIME(bool enabled) {
+	IME = enabled;
+}
+
+// IF and IE registers as seen on the bus
+uint8_t InterruptController::read(uint16_t addr) {
+	return addr == 0xFFFF ? enable : flags;
+}
+
+void InterruptController::write(uint16_t addr, uint8_t data) {
+	if (addr == 0xFFFF) {
+		setEnable(data);
+	}
+	else {
+		setFlags(data);
+	}
+}
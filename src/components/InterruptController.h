@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Interrupt Flags (IF), Interrupt Enable (IE) and IME
+// Requested and enabled interrupts are cached in one mask, updated only when IF, IE or IME change,
+// so checking for an interrupt between two instructions is a single test
+class InterruptController
+{
+public:
+	// Interrupt sources, by priority order (bit of IF and IE)
+	enum interrupt_source_t : uint8_t {
+		vBlank,
+		lcd,
+		timer,
+		serial,
+		joypad,
+		count
+	};
+
+	enum interrupt_flags_t {
+		j = (1 << joypad),
+		s = (1 << serial),
+		t = (1 << timer),
+		l = (1 << lcd),
+		v = (1 << vBlank)
+	};
+
+private:
+	uint8_t flags = 0x00;	// IF Register
+	uint8_t enable = 0x00;	// IE Register
+	bool IME = false;
+
+	uint8_t pending = 0x00;	// Requested and enabled interrupts (IF & IE), they wake up a halted CPU even if IME is reset
+
+public:
+	InterruptController();
+	~InterruptController();
+
+	void request(interrupt_source_t source);
+	void acknowledge(interrupt_source_t source);
+
+	void setFlags(uint8_t data);
+	void setEnable(uint8_t data);
+	void setIME(bool enabled);
+
+	uint8_t read(uint16_t addr);
+	void write(uint16_t addr, uint8_t data);
+
+	uint8_t getFlags() const { return flags; }
+	uint8_t getEnable() const { return enable; }
+	bool getIME() const { return IME; }
+
+	// Whether any requested interrupt is enabled
+	bool isPending() const { return pending; }
+
+	// Whether the CPU has to dispatch an interrupt before its next instruction
+	bool isDispatchable() const { return IME && pending; }
+
+	// Highest priority pending interrupt, only valid if one is pending
+	interrupt_source_t getNext() const { return (interrupt_source_t)countTrailingZeros(pending); }
+
+	static uint16_t getVector(interrupt_source_t source) { return 0x40 + (source << 3); }
+
+private:
+	void update() { pending = flags & enable & ((1 << count) - 1); }
+
+	static uint8_t countTrailingZeros(uint8_t v) {
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward(&index, v);
+		return (uint8_t)index;
+#else
+		return (uint8_t)__builtin_ctz(v);
+#endif
+	}
+};
@@ -0,0 +1,163 @@
+#include "RealTimeClock.h"
+
+#include <chrono>
+
+RealTimeClock::RealTimeClock() {
+	reference = getTime();
+}
+
+RealTimeClock::~RealTimeClock() {
+
+}
+
+// Use the M-cycles counted by the scheduler as the emulated time
+void RealTimeClock::connectClock(const uint64_t* c) {
+	sync();
+	cycles = c;
+
+	if (mode == emulatedTime) {
+		reference = getTime();
+	}
+}
+
+void RealTimeClock::setMode(rtc_mode_t m) {
+	sync();
+	mode = m;
+	reference = getTime();
+}
+
+// Write to a register (0x08 - 0x0C), the counter is rebuilt from the registers
+void RealTimeClock::write(uint8_t reg, uint8_t data) {
+	static constexpr uint8_t masks[5] = { 0x3F, 0x3F, 0x1F, 0xFF, 0xC1 };
+
+	uint8_t registers[5];
+
+	sync();
+	getRegisters(registers);
+
+	registers[reg - 0x08] = data & masks[reg - 0x08];
+	setRegisters(registers);
+
+	// Writing the seconds resets the sub-second counter
+	if (reg == 0x08) {
+		reference = getTime();
+	}
+
+	isChanged = true;
+}
+
+// Copy the current time to the registers read by the CPU
+void RealTimeClock::latch() {
+	sync();
+	getRegisters(latched);
+}
+
+// Restore the clock from a .sav trailer, in host time the clock also counts the time elapsed since the save
+// Returns false if the trailer is not an RTC one
+bool RealTimeClock::load(const uint8_t* trailer, uint32_t size) {
+	if (size != trailerSize && size != trailerSize - 4) {
+		return false;
+	}
+
+	auto get = [trailer](uint32_t offset, uint8_t bytes) {
+		uint64_t value = 0;
+
+		for (uint8_t i = 0; i < bytes; i++) {
+			value |= (uint64_t)trailer[offset + i] << (i * 8);
+		}
+
+		return value;
+	};
+
+	uint8_t registers[5];
+
+	for (uint8_t i = 0; i < 5; i++) {
+		registers[i] = (uint8_t)get(i * 4, 1);
+		latched[i] = (uint8_t)get(20 + i * 4, 1);
+	}
+
+	setRegisters(registers);
+	reference = getTime();
+
+	uint64_t savedTime = get(40, size - 40);
+	uint64_t now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+	if (mode == hostTime && !isHalted && now > savedTime) {
+		seconds += now - savedTime;
+		sync();
+	}
+
+	isChanged = false;
+
+	return true;
+}
+
+// Write the clock as a .sav trailer (trailerSize bytes)
+void RealTimeClock::save(uint8_t* trailer) {
+	auto put = [trailer](uint32_t offset, uint64_t value, uint8_t bytes) {
+		for (uint8_t i = 0; i < bytes; i++) {
+			trailer[offset + i] = (uint8_t)(value >> (i * 8));
+		}
+	};
+
+	uint8_t registers[5];
+
+	sync();
+	getRegisters(registers);
+
+	for (uint8_t i = 0; i < 5; i++) {
+		put(i * 4, registers[i], 4);
+		put(20 + i * 4, latched[i], 4);
+	}
+
+	put(40, std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count(), 8);
+
+	isChanged = false;
+}
+
+// Move the counter to the current time, the sub-second part stays in the reference
+void RealTimeClock::sync() {
+	uint64_t now = getTime();
+
+	if (isHalted || now < reference) {	// Time doesn't run while halted (or the host clock went back)
+		reference = now;
+	}
+	else {
+		uint64_t elapsed = (now - reference) / getUnitsPerSecond();
+
+		seconds += elapsed;
+		reference += elapsed * getUnitsPerSecond();
+	}
+
+	if (seconds >= 512 * secondsPerDay) {
+		isCarry = true;
+		seconds %= 512 * secondsPerDay;
+	}
+}
+
+uint64_t RealTimeClock::getTime() const {
+	if (mode == emulatedTime) {
+		return cycles ? *cycles : 0;
+	}
+
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+void RealTimeClock::getRegisters(uint8_t registers[5]) const {
+	uint64_t days = seconds / secondsPerDay;
+
+	registers[0] = seconds % 60;
+	registers[1] = seconds / 60 % 60;
+	registers[2] = seconds / 3600 % 24;
+	registers[3] = days & 0xFF;
+	registers[4] = ((days >> 8) & 0x01) | (isHalted ? 0x40 : 0x00) | (isCarry ? 0x80 : 0x00);
+}
+
+// Out of range values (60 seconds and more...) are carried to the next unit instead of counting up to their maximum
+void RealTimeClock::setRegisters(const uint8_t registers[5]) {
+	uint64_t days = registers[3] | ((registers[4] & 0x01) << 8);
+
+	seconds = registers[0] + registers[1] * 60 + registers[2] * 3600 + days * secondsPerDay;
+	isHalted = registers[4] & 0x40;
+	isCarry = registers[4] & 0x80;
+}
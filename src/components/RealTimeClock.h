@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+
+// MBC3 real-time clock
+// The clock is a counter of seconds and the time at which it had this value, the registers are only computed from them
+// when the clock is latched or written (reads return the latched registers, as on hardware), nothing runs in between
+// Time is either the emulated time (M-cycles of the scheduler) or the host time, which also runs while the emulator is closed
+class RealTimeClock
+{
+public:
+	enum rtc_mode_t : uint8_t {
+		emulatedTime,
+		hostTime
+	};
+
+	// RTC data saved after the RAM in .sav files: current and latched registers (5 * 4 bytes each, seconds, minutes, hours,
+	// day low, day high) and the host time of the save (UNIX time on 8 bytes, 4 in the older 44-byte version)
+	static constexpr uint32_t trailerSize = 48;
+
+	bool isChanged = false;		// Registers written since the last save
+
+private:
+	const uint64_t* cycles = nullptr;	// Emulated time
+	rtc_mode_t mode = hostTime;
+
+	uint64_t seconds = 0;		// Counter value (days are kept under 512) at the reference time
+	uint64_t reference = 0;		// In M-cycles or host milliseconds
+	bool isHalted = false;
+	bool isCarry = false;		// Day counter overflow, stays set until written
+
+	uint8_t latched[5] = {};	// Registers 0x08 - 0x0C as read by the CPU
+
+	static constexpr uint64_t cyclesPerSecond = 1048576;
+	static constexpr uint64_t secondsPerDay = 86400;
+
+public:
+	RealTimeClock();
+	~RealTimeClock();
+
+	void connectClock(const uint64_t* c);
+	void setMode(rtc_mode_t m);
+
+	uint8_t read(uint8_t reg) const { return latched[reg - 0x08]; }
+	void write(uint8_t reg, uint8_t data);
+	void latch();
+
+	bool load(const uint8_t* trailer, uint32_t size);
+	void save(uint8_t* trailer);
+
+private:
+	void sync();
+	uint64_t getTime() const;
+	uint64_t getUnitsPerSecond() const { return mode == emulatedTime ? cyclesPerSecond : 1000; }
+	void getRegisters(uint8_t registers[5]) const;
+	void setRegisters(const uint8_t registers[5]);
+};
@@ -0,0 +1,450 @@
+#include "Recompiler.h"
+
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include "Bus.h"
+
+#if CPU_JIT
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Generated code uses R10 for the CPU registers, R11 for the flags table, and AL, CL, DL and AH as scratch registers
+// They are all volatile in both Windows and System V calling conventions so nothing has to be saved
+
+Recompiler::Recompiler(Bus* b) {
+	bus = b;
+
+	for (uint16_t i = 0; i < 0x100; i++) {
+		flagsTable[i] = ((i & 0x40) ? CPU<Bus>::cpu_flags_t::z : 0)	// ZF
+			| ((i & 0x10) ? CPU<Bus>::cpu_flags_t::h : 0)				// AF (carry from bit 3)
+			| ((i & 0x01) ? CPU<Bus>::cpu_flags_t::c : 0);				// CF
+	}
+
+#ifdef _WIN32
+	code = (uint8_t*)VirtualAlloc(nullptr, codeSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+	void* memory = mmap(nullptr, codeSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	code = memory == MAP_FAILED ? nullptr : (uint8_t*)memory;
+
+	perfMap.open("/tmp/perf-" + std::to_string(getpid()) + ".map", std::ofstream::out | std::ofstream::app);
+#endif
+
+	if (!code) {
+		std::cout << "Failed to allocate recompiler memory, only the interpreter will be used" << std::endl;
+	}
+}
+
+Recompiler::~Recompiler() {
+	if (code) {
+#ifdef _WIN32
+		VirtualFree(code, 0, MEM_RELEASE);
+#else
+		munmap(code, codeSize);
+#endif
+	}
+}
+
+// Compiled block starting at PC, blocks are compiled once they've been looked up enough times (nullptr if not compiled)
+const Recompiler::jit_block_t* Recompiler::lookup(uint16_t pc) {
+	// Only ROM is compiled so the code can't be modified
+	if (!code || pc > 0x7FFF) {
+		return nullptr;
+	}
+
+	uint16_t bank = bus->cart->getRomBank(pc);
+	jit_block_t& block = blocks[((uint32_t)bank << 16) | pc];
+
+	if (!block.isCompiled) {
+		if (++block.heat < hotThreshold) {
+			return nullptr;
+		}
+
+		// Every block is dropped when the executable memory is full, then they get hot again
+		if (codeSize - codeUsed < 0x1000) {
+			clear();
+			flushes++;
+
+			return nullptr;
+		}
+
+		compile(block, bank, pc);
+	}
+
+	return block.code ? &block : nullptr;
+}
+
+void Recompiler::run(const jit_block_t* block, uint8_t* registers) {
+	block->code(registers, flagsTable);
+
+	executed++;
+	instructions += block->length;
+}
+
+void Recompiler::clear() {
+	blocks.clear();
+	codeUsed = 0;
+}
+
+size_t Recompiler::getBlockCount() const {
+	return blocks.size();
+}
+
+bool Recompiler::isSupported() {
+	return true;
+}
+
+// Compile instructions from PC up to the first one that is not supported (or the end of the ROM bank)
+void Recompiler::compile(jit_block_t& block, uint16_t bank, uint16_t pc) {
+	buffer.clear();
+
+#ifdef _WIN32
+	emit({ 0x49, 0x89, 0xCA });	// MOV R10, RCX
+	emit({ 0x49, 0x89, 0xD3 });	// MOV R11, RDX
+#else
+	emit({ 0x49, 0x89, 0xFA });	// MOV R10, RDI
+	emit({ 0x49, 0x89, 0xF3 });	// MOV R11, RSI
+#endif
+
+	uint16_t addr = pc;
+
+	while (block.length < maxBlockLength) {
+		uint8_t opcode = bus->read(addr);
+		uint8_t n8 = bus->read(addr + 1);
+		uint16_t n16 = n8 | (bus->read(addr + 2) << 8);
+
+		uint8_t length = 1;
+		if (opcode == 0xCB || (opcode & 0xC7) == 0x06 || (opcode & 0xC7) == 0xC6) {
+			length = 2;
+		}
+		else if ((opcode & 0xCF) == 0x01) {
+			length = 3;
+		}
+
+		// The instruction has to be in the same ROM bank as the block
+		if (((addr + length - 1) & 0xC000) != (pc & 0xC000)) {
+			break;
+		}
+
+		size_t mark = buffer.size();
+
+		if (!(opcode == 0xCB ? emitPrefixed(n8) : emitInstruction(opcode, n8, n16))) {
+			buffer.resize(mark);
+			break;
+		}
+
+		block.cycles += opcode == 0xCB ? CPU<Bus>::prefixed[n8].cycles : CPU<Bus>::instructions[opcode].cycles;
+		block.length++;
+		addr += length;
+	}
+
+	block.end = addr;
+	block.isCompiled = true;
+
+	if (block.length < minBlockLength) {
+		return;
+	}
+
+	emit({ 0xC3 });	// RET
+
+	block.code = install();
+	compiled++;
+
+	if (perfMap.is_open() && block.code) {
+		perfMap << std::hex << (uintptr_t)block.code << " " << buffer.size()
+			<< " sm83_" << std::setw(3) << std::setfill('0') << bank << "_" << std::setw(4) << pc << std::dec << std::endl;
+	}
+}
+
+// Copy the emitted code to the executable memory
+Recompiler::jit_code_t Recompiler::install() {
+	uint8_t* dest = code + codeUsed;
+
+	// Memory is only writable while the code is copied
+#ifdef _WIN32
+	DWORD protect;
+	VirtualProtect(code, codeSize, PAGE_READWRITE, &protect);
+	memcpy(dest, buffer.data(), buffer.size());
+	VirtualProtect(code, codeSize, PAGE_EXECUTE_READ, &protect);
+	FlushInstructionCache(GetCurrentProcess(), dest, buffer.size());
+#else
+	if (mprotect(code, codeSize, PROT_READ | PROT_WRITE)) {
+		return nullptr;
+	}
+
+	memcpy(dest, buffer.data(), buffer.size());
+
+	if (mprotect(code, codeSize, PROT_READ | PROT_EXEC)) {
+		return nullptr;
+	}
+#endif
+
+	codeUsed += (buffer.size() + 0xF) & ~0xF;	// Blocks are aligned on 16 bytes
+
+	return (jit_code_t)dest;
+}
+
+// Emit an instruction working on registers, return false if it's not supported
+bool Recompiler::emitInstruction(uint8_t opcode, uint8_t n8, uint16_t n16) {
+	const uint8_t A = getRegisterOffset(0b111);
+	const uint8_t F = offsetof(CPU<Bus>::cpu_registers_t, AF);
+
+	// NOP
+	if (opcode == 0x00) {
+		return true;
+	}
+
+	// LD r16, n16
+	if ((opcode & 0xCF) == 0x01) {
+		emit({ 0x66, 0x41, 0xC7, 0x42, (uint8_t)getRegister16Offset((opcode >> 4) & 0b11), (uint8_t)(n16 & 0xFF), (uint8_t)(n16 >> 8) });	// MOV WORD [R10 + r16], n16
+		return true;
+	}
+
+	// INC r16 / DEC r16
+	if ((opcode & 0xCF) == 0x03 || (opcode & 0xCF) == 0x0B) {
+		emit({ 0x66, 0x41, 0xFF, (uint8_t)((opcode & 0x08) ? 0x4A : 0x42), (uint8_t)getRegister16Offset((opcode >> 4) & 0b11) });	// INC/DEC WORD [R10 + r16]
+		return true;
+	}
+
+	// INC r8 / DEC r8 (Carry flag is not affected, as with x86)
+	if ((opcode & 0xC6) == 0x04 && ((opcode >> 3) & 0b111) != 0b110) {
+		uint8_t r = getRegisterOffset((opcode >> 3) & 0b111);
+		bool isDec = opcode & 0x01;
+
+		emitLoad(0, r);
+		emitCarryIn();
+		emit({ 0xFE, (uint8_t)(isDec ? 0xC8 : 0xC0) });	// INC/DEC AL
+		emit({ 0x9F });									// LAHF
+		emitStore(0, r);
+		emitFlagsFromHost(isDec);
+		emitFlagsStore();
+		return true;
+	}
+
+	// LD r8, n8
+	if ((opcode & 0xC7) == 0x06 && ((opcode >> 3) & 0b111) != 0b110) {
+		emit({ 0x41, 0xC6, 0x42, (uint8_t)getRegisterOffset((opcode >> 3) & 0b111), n8 });	// MOV BYTE [R10 + r8], n8
+		return true;
+	}
+
+	// RLCA, RRCA, RLA, RRA (Zero flag is always reset)
+	if ((opcode & 0xE7) == 0x07) {
+		uint8_t op = (opcode >> 3) & 0b11;	// x86 ROL, ROR, RCL, RCR
+
+		if (op >= 2) {
+			emitCarryIn();
+		}
+
+		emit({ 0x41, 0xD0, (uint8_t)(0x42 | (op << 3)), A });	// ROL/ROR/RCL/RCR BYTE [R10 + A], 1
+		emit({ 0x0F, 0x92, 0xC2 });								// SETC DL
+		emit({ 0xC0, 0xE2, 0x04 });								// SHL DL, 4
+		emitFlagsStore();
+		return true;
+	}
+
+	switch (opcode) {
+	case 0x2F:	// CPL
+		emit({ 0x41, 0xF6, 0x52, A });			// NOT BYTE [R10 + A]
+		emit({ 0x41, 0x80, 0x4A, F, 0x60 });	// OR BYTE [R10 + F], N | H
+		return true;
+	case 0x37:	// SCF
+		emitLoad(0, F);
+		emit({ 0x24, 0x80 });					// AND AL, Z
+		emit({ 0x0C, 0x10 });					// OR AL, C
+		emitStore(0, F);
+		return true;
+	case 0x3F:	// CCF
+		emitLoad(0, F);
+		emit({ 0x24, 0x90 });					// AND AL, Z | C
+		emit({ 0x34, 0x10 });					// XOR AL, C
+		emitStore(0, F);
+		return true;
+	}
+
+	// LD r8, r8'
+	if (opcode >= 0x40 && opcode <= 0x7F && (opcode & 0b111) != 0b110 && ((opcode >> 3) & 0b111) != 0b110) {
+		emitLoad(0, getRegisterOffset(opcode & 0b111));
+		emitStore(0, getRegisterOffset((opcode >> 3) & 0b111));
+		return true;
+	}
+
+	// ADD, ADC, SUB, SBC, AND, XOR, OR, CP A, r8 / A, n8
+	bool isImmediate = (opcode & 0xC7) == 0xC6;
+
+	if ((opcode >= 0x80 && opcode <= 0xBF && (opcode & 0b111) != 0b110) || isImmediate) {
+		// x86 opcodes of ADD, ADC, SUB, SBB, AND, XOR, OR and CMP (AL, CL form and AL, imm8 form)
+		static constexpr uint8_t aluRegister[8] = { 0x00, 0x10, 0x28, 0x18, 0x20, 0x30, 0x08, 0x38 };
+		static constexpr uint8_t aluImmediate[8] = { 0x04, 0x14, 0x2C, 0x1C, 0x24, 0x34, 0x0C, 0x3C };
+
+		uint8_t alu = (opcode >> 3) & 0b111;
+
+		emitLoad(0, A);
+
+		if (alu == 0b001 || alu == 0b011) {
+			emitCarryIn();
+		}
+
+		if (isImmediate) {
+			emit({ aluImmediate[alu], n8 });	// OP AL, n8
+		}
+		else {
+			emitLoad(1, getRegisterOffset(opcode & 0b111));
+			emit({ aluRegister[alu], 0xC8 });	// OP AL, CL
+		}
+
+		if (alu <= 0b011 || alu == 0b111) {
+			// Arithmetic: x86 Z, half carry and carry flags are the same as SM83 ones
+			emit({ 0x9F });	// LAHF
+
+			if (alu != 0b111) {
+				emitStore(0, A);
+			}
+
+			emitFlagsFromHost(alu >= 0b010);
+		}
+		else {
+			// Logic: only Zero flag comes from the result (and Half carry is set by AND)
+			emitStore(0, A);
+			emit({ 0x0F, 0x94, 0xC2 });	// SETZ DL
+			emit({ 0xC0, 0xE2, 0x07 });	// SHL DL, 7
+
+			if (alu == 0b100) {
+				emit({ 0x80, 0xCA, 0x20 });	// OR DL, H
+			}
+		}
+
+		emitFlagsStore();
+		return true;
+	}
+
+	return false;
+}
+
+// Emit a prefixed instruction working on a register, return false if it's not supported
+bool Recompiler::emitPrefixed(uint8_t opcode) {
+	if ((opcode & 0b111) == 0b110) {
+		return false;
+	}
+
+	const uint8_t F = offsetof(CPU<Bus>::cpu_registers_t, AF);
+	uint8_t r = getRegisterOffset(opcode & 0b111);
+	uint8_t bit = (opcode >> 3) & 0b111;
+
+	if (opcode < 0x40) {
+		if (bit == 6) {
+			// SWAP
+			emit({ 0x41, 0xC0, 0x42, r, 0x04 });	// ROL BYTE [R10 + r8], 4
+			emit({ 0x31, 0xD2 });					// XOR EDX, EDX
+		}
+		else {
+			// x86 ROL, ROR, RCL, RCR, SHL, SAR, SHR for RLC, RRC, RL, RR, SLA, SRA, SRL
+			static constexpr uint8_t shifts[8] = { 0, 1, 2, 3, 4, 7, 0, 5 };
+
+			if (bit == 2 || bit == 3) {
+				emitCarryIn();
+			}
+
+			emit({ 0x41, 0xD0, (uint8_t)(0x42 | (shifts[bit] << 3)), r });	// OP BYTE [R10 + r8], 1
+			emit({ 0x0F, 0x92, 0xC2 });										// SETC DL
+			emit({ 0xC0, 0xE2, 0x04 });										// SHL DL, 4
+		}
+
+		emitZeroFlag(r);
+		emitFlagsStore();
+	}
+	else if (opcode < 0x80) {
+		// BIT (Carry flag is not affected)
+		emitLoad(0, F);
+		emit({ 0x24, 0x10 });							// AND AL, C
+		emit({ 0x0C, 0x20 });							// OR AL, H
+		emit({ 0x41, 0xF6, 0x42, r, (uint8_t)(1 << bit) });	// TEST BYTE [R10 + r8], bit
+		emit({ 0x0F, 0x94, 0xC2 });						// SETZ DL
+		emit({ 0xC0, 0xE2, 0x07 });						// SHL DL, 7
+		emit({ 0x08, 0xC2 });							// OR DL, AL
+		emitFlagsStore();
+	}
+	else if (opcode < 0xC0) {
+		emit({ 0x41, 0x80, 0x62, r, (uint8_t)~(1 << bit) });	// AND BYTE [R10 + r8], ~bit (RES)
+	}
+	else {
+		emit({ 0x41, 0x80, 0x4A, r, (uint8_t)(1 << bit) });		// OR BYTE [R10 + r8], bit (SET)
+	}
+
+	return true;
+}
+
+void Recompiler::emit(std::initializer_list<uint8_t> bytes) {
+	buffer.insert(buffer.end(), bytes);
+}
+
+// MOV AL/CL/DL, [R10 + offset]
+void Recompiler::emitLoad(uint8_t reg, uint8_t offset) {
+	emit({ 0x41, 0x8A, (uint8_t)(0x42 | (reg << 3)), offset });
+}
+
+// MOV [R10 + offset], AL/CL/DL
+void Recompiler::emitStore(uint8_t reg, uint8_t offset) {
+	emit({ 0x41, 0x88, (uint8_t)(0x42 | (reg << 3)), offset });
+}
+
+// Copy the Carry flag to the x86 carry
+void Recompiler::emitCarryIn() {
+	emit({ 0x41, 0x0F, 0xBA, 0x62, (uint8_t)offsetof(CPU<Bus>::cpu_registers_t, AF), 0x04 });	// BT DWORD [R10 + F], 4
+}
+
+// Convert the x86 flags in AH to Z, H and C flags in DL, N flag is set from the argument
+void Recompiler::emitFlagsFromHost(uint8_t n) {
+	emit({ 0x0F, 0xB6, 0xD4 });				// MOVZX EDX, AH
+	emit({ 0x41, 0x0F, 0xB6, 0x14, 0x13 });	// MOVZX EDX, BYTE [R11 + RDX]
+
+	if (n) {
+		emit({ 0x80, 0xCA, 0x40 });			// OR DL, N
+	}
+}
+
+void Recompiler::emitFlagsStore() {
+	emitStore(2, offsetof(CPU<Bus>::cpu_registers_t, AF));
+}
+
+// Add the Zero flag of a register to DL
+void Recompiler::emitZeroFlag(uint8_t offset) {
+	emit({ 0x41, 0x80, 0x7A, offset, 0x00 });	// CMP BYTE [R10 + r8], 0
+	emit({ 0x0F, 0x94, 0xC0 });					// SETZ AL
+	emit({ 0xC0, 0xE0, 0x07 });					// SHL AL, 7
+	emit({ 0x08, 0xC2 });						// OR DL, AL
+}
+
+// Offset of an 8-bit register in the CPU registers from its 3-bit code in the opcode (-1 for [HL])
+int8_t Recompiler::getRegisterOffset(uint8_t bits) {
+	switch (bits) {
+	case 0b000: return offsetof(CPU<Bus>::cpu_registers_t, BC) + 1;
+	case 0b001: return offsetof(CPU<Bus>::cpu_registers_t, BC);
+	case 0b010: return offsetof(CPU<Bus>::cpu_registers_t, DE) + 1;
+	case 0b011: return offsetof(CPU<Bus>::cpu_registers_t, DE);
+	case 0b100: return offsetof(CPU<Bus>::cpu_registers_t, HL) + 1;
+	case 0b101: return offsetof(CPU<Bus>::cpu_registers_t, HL);
+	case 0b111: return offsetof(CPU<Bus>::cpu_registers_t, AF) + 1;
+	}
+
+	return -1;
+}
+
+// Offset of a 16-bit register in the CPU registers from its 2-bit code in the opcode
+int8_t Recompiler::getRegister16Offset(uint8_t bits) {
+	switch (bits) {
+	case 0b00: return offsetof(CPU<Bus>::cpu_registers_t, BC);
+	case 0b01: return offsetof(CPU<Bus>::cpu_registers_t, DE);
+	case 0b10: return offsetof(CPU<Bus>::cpu_registers_t, HL);
+	}
+
+	return offsetof(CPU<Bus>::cpu_registers_t, SP);
+}
+
+#endif
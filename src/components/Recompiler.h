@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <initializer_list>
+#include <unordered_map>
+#include <vector>
+
+class Bus;
+
+// Dynamic recompiler of hot ROM blocks into x86-64 code
+// Only instructions working on registers are compiled (loads, ALU, INC/DEC, rotates and CB bit operations),
+// so a compiled block never accesses the bus and only needs the CPU registers
+// Anything else (memory accesses, I/O, branches, interrupts related instructions) is left to the interpreter
+class Recompiler
+{
+public:
+	// Compiled code, called with the CPU registers and the flags conversion table
+	typedef void(*jit_code_t)(uint8_t* registers, const uint8_t* flags);
+
+	struct jit_block_t {
+		jit_code_t code = nullptr;	// nullptr until compiled, or if the block is too short to be compiled
+		uint16_t end = 0x0000;		// Address following the last compiled instruction
+		uint8_t cycles = 0;			// M-cycles of the whole block
+		uint8_t length = 0;			// Number of instructions
+		uint8_t heat = 0;			// Number of lookups before being compiled
+		bool isCompiled = false;
+	};
+
+	static constexpr uint8_t hotThreshold = 16;		// Lookups of a block before compiling it
+	static constexpr uint8_t minBlockLength = 2;	// Shorter blocks are left to the interpreter
+	static constexpr uint8_t maxBlockLength = 32;
+	static constexpr size_t codeSize = 0x100000;	// Executable memory (1 MiB), flushed when full
+
+	// Statistics
+	uint64_t compiled = 0;		// Blocks compiled
+	uint64_t executed = 0;		// Compiled blocks executed
+	uint64_t instructions = 0;	// Instructions executed from compiled blocks
+	uint64_t deferred = 0;		// Compiled blocks left to the interpreter because an interrupt could be raised during them
+	uint64_t flushes = 0;		// Executable memory flushed because it was full
+
+private:
+	Bus* bus = nullptr;
+
+	std::unordered_map<uint32_t, jit_block_t> blocks;
+
+	uint8_t* code = nullptr;	// Executable memory
+	size_t codeUsed = 0;
+	std::vector<uint8_t> buffer;	// Code being emitted
+
+	uint8_t flagsTable[0x100];	// x86 flags (as loaded in AH by LAHF) to Z, H and C flags
+
+	std::ofstream perfMap;		// Symbols of the compiled blocks for perf (/tmp/perf-<pid>.map)
+
+public:
+	Recompiler(Bus* b);
+	~Recompiler();
+
+	const jit_block_t* lookup(uint16_t pc);
+	void run(const jit_block_t* block, uint8_t* registers);
+	void clear();
+
+	size_t getBlockCount() const;
+
+	static bool isSupported();
+
+private:
+	void compile(jit_block_t& block, uint16_t bank, uint16_t pc);
+	bool emitInstruction(uint8_t opcode, uint8_t n8, uint16_t n16);
+	bool emitPrefixed(uint8_t opcode);
+	jit_code_t install();
+
+	void emit(std::initializer_list<uint8_t> bytes);
+	void emitLoad(uint8_t reg, uint8_t offset);
+	void emitStore(uint8_t reg, uint8_t offset);
+	void emitCarryIn();
+	void emitFlagsFromHost(uint8_t n);
+	void emitFlagsStore();
+	void emitZeroFlag(uint8_t offset);
+
+	static int8_t getRegisterOffset(uint8_t bits);
+	static int8_t getRegister16Offset(uint8_t bits);
+};
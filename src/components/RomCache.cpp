@@ -0,0 +1,337 @@
+#include "RomCache.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+#if CARTRIDGE_MMAP
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#endif
+
+RomImage::RomImage() {
+
+}
+
+RomImage::~RomImage() {
+	unload();
+}
+
+// Map the ROM file in memory, returns false if it can't be mapped so it's read in a buffer instead
+bool RomImage::mapFile(const std::string& filename) {
+#if CARTRIDGE_MMAP
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	HANDLE mapping = nullptr;
+
+	if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0 && fileSize.QuadPart <= UINT32_MAX) {
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	}
+
+	CloseHandle(file);
+
+	if (!mapping) {
+		return false;
+	}
+
+	void* memory = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);	// The view keeps the mapping open
+
+	if (!memory) {
+		return false;
+	}
+
+	size = (uint32_t)fileSize.QuadPart;
+#else
+	int file = open(filename.c_str(), O_RDONLY);
+
+	if (file < 0) {
+		return false;
+	}
+
+	struct stat status;
+	void* memory = MAP_FAILED;
+
+	if (fstat(file, &status) == 0 && status.st_size > 0 && status.st_size <= UINT32_MAX) {
+		memory = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+	}
+
+	close(file);	// The mapping keeps the file open
+
+	if (memory == MAP_FAILED) {
+		return false;
+	}
+
+	size = (uint32_t)status.st_size;
+#endif
+
+	data = (const uint8_t*)memory;
+	isMapped = true;
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+// Read the whole ROM file in a buffer
+bool RomImage::loadFile(const std::string& filename) {
+	std::ifstream ifs;
+	ifs.open(filename.c_str(), std::ifstream::binary);
+
+	if (!ifs.is_open()) {
+		std::cout << "Failed to open file: " << filename << std::endl;
+		return false;
+	}
+
+	ifs.seekg(0, ifs.end);
+	size = (uint32_t)ifs.tellg();
+	ifs.seekg(0, ifs.beg);
+
+	uint8_t* buffer = new uint8_t[size];
+
+	ifs.read((char *)buffer, size);
+	ifs.close();
+
+	data = buffer;
+	isMapped = false;
+
+	return true;
+}
+
+// Load the whole mapped file ahead, before it is read from start to end to be hashed
+void RomImage::prefetch() {
+#if CARTRIDGE_MMAP && !defined(_WIN32)
+	if (isMapped) {
+		madvise((void*)data, size, MADV_WILLNEED);
+	}
+#endif
+}
+
+void RomImage::unload() {
+	if (isMapped) {
+#if CARTRIDGE_MMAP
+#ifdef _WIN32
+		UnmapViewOfFile(data);
+#else
+		munmap((void*)data, size);
+#endif
+#endif
+	}
+	else {
+		delete[] data;
+	}
+
+	data = nullptr;
+	size = 0;
+	isMapped = false;
+}
+
+RomCache::RomCache() {
+
+}
+
+RomCache::~RomCache() {
+	for (auto& entry : images) {
+		delete entry.second;
+	}
+}
+
+// Image of a ROM file, loaded if it's not cached yet (nullptr if the file can't be read or isn't valid)
+// Every acquired image has to be released
+const RomImage* RomCache::acquire(const std::string& filename, validator_t isValid) {
+	std::error_code error;
+	uint64_t fileSize = std::filesystem::file_size(filename, error);
+	int64_t fileTime = 0;
+
+	if (!error) {
+		fileTime = (int64_t)std::filesystem::last_write_time(filename, error).time_since_epoch().count();
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		// Unchanged file already loaded
+		auto file = files.find(filename);
+
+		if (!error && file != files.end() && file->second.size == fileSize && file->second.time == fileTime) {
+			auto cached = images.find(file->second.hash);
+
+			if (cached != images.end()) {
+				hits++;
+				cached->second->references++;
+
+				return cached->second;
+			}
+		}
+	}
+
+	// Read and hashed without holding the lock, so the other cartridges being created don't wait for this file
+	RomImage* image = load(filename, isValid);
+
+	if (!image) {
+		return nullptr;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	// The same content may have been cached meanwhile
+	auto cached = images.find(image->hash);
+
+	if (cached == images.end()) {
+		misses++;
+		images.emplace(image->hash, image);
+	}
+	else if (cached->second->size == image->size && memcmp(cached->second->data, image->data, image->size) == 0) {
+		sharedLoads++;
+		delete image;
+		image = cached->second;
+	}
+	else {
+		// Different content with the same hash, this image is not shared
+		misses++;
+		image->references++;
+
+		return image;
+	}
+
+	if (!error) {
+		files[filename] = { fileSize, fileTime, image->hash };
+	}
+
+	image->references++;
+
+	return image;
+}
+
+void RomCache::release(const RomImage* image) {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	RomImage* released = const_cast<RomImage*>(image);
+
+	if (--released->references > 0) {
+		return;
+	}
+
+	auto cached = images.find(released->hash);
+
+	if (cached == images.end() || cached->second != released) {	// Not shared
+		delete released;
+		return;
+	}
+
+	evict(unusedBudget);
+}
+
+// Free every image that is not used
+void RomCache::trim() {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	evict(0);
+}
+
+// ROM bytes held by the cache
+uint64_t RomCache::getCachedBytes() {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	uint64_t bytes = 0;
+
+	for (auto& entry : images) {
+		bytes += entry.second->size;
+	}
+
+	return bytes;
+}
+
+// ROM bytes that would be held by the cartridges using a cached image if each of them had its own copy, minus the one
+// held by the cache
+uint64_t RomCache::getSavedBytes() {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	uint64_t bytes = 0;
+
+	for (auto& entry : images) {
+		if (entry.second->references > 1) {
+			bytes += (uint64_t)(entry.second->references - 1) * entry.second->size;
+		}
+	}
+
+	return bytes;
+}
+
+// 64-bit hash of the content of a ROM, 8 bytes at a time
+uint64_t RomCache::hash(const uint8_t* data, uint32_t size) {
+	uint64_t h = 0x9E3779B97F4A7C15 ^ size;
+	uint32_t i = 0;
+
+	for (; i + 8 <= size; i += 8) {
+		uint64_t word;
+		memcpy(&word, data + i, 8);
+
+		h = (h ^ word) * 0xFF51AFD7ED558CCD;
+		h ^= h >> 32;
+	}
+
+	for (; i < size; i++) {
+		h = (h ^ data[i]) * 0x100000001B3;
+	}
+
+	return h;
+}
+
+RomImage* RomCache::load(const std::string& filename, validator_t isValid) {
+	RomImage* image = new RomImage();
+
+	if (!image->mapFile(filename) && !image->loadFile(filename)) {
+		delete image;
+		return nullptr;
+	}
+
+	// Only the first page of a mapped file has been touched so far
+	if (isValid && !isValid(image->data, image->size)) {
+		std::cout << "ROM non valid." << std::endl;
+		delete image;
+		return nullptr;
+	}
+
+	image->prefetch();
+	image->hash = hash(image->data, image->size);
+
+	return image;
+}
+
+// Free unused images until they take at most 'budget' bytes
+void RomCache::evict(uint64_t budget) {
+	uint64_t unused = 0;
+
+	for (auto& entry : images) {
+		if (!entry.second->references) {
+			unused += entry.second->size;
+		}
+	}
+
+	for (auto it = images.begin(); it != images.end() && unused > budget;) {
+		if (!it->second->references) {
+			unused -= it->second->size;
+			delete it->second;
+			it = images.erase(it);
+			evictions++;
+		}
+		else {
+			it++;
+		}
+	}
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "../Config.h"
+
+// Contents of a ROM file, immutable once loaded so that every cartridge running the same ROM can share it
+class RomImage
+{
+public:
+	const uint8_t* data = nullptr;
+	uint32_t size = 0;
+	uint64_t hash = 0;		// Content hash, key of the image in the cache
+
+private:
+	bool isMapped = false;	// Data is a mapping of the file, not a buffer
+	uint32_t references = 0;
+
+	friend class RomCache;
+
+public:
+	RomImage();
+	~RomImage();
+
+private:
+	bool mapFile(const std::string& filename);
+	bool loadFile(const std::string& filename);
+	void prefetch();
+	void unload();
+};
+
+// Process-wide cache of the ROM images, by content hash
+// Cartridges acquire their image when they are created and release it when they are destroyed, so instances of the same
+// ROM share a single copy and only keep their mapper state and RAM. Unused images are kept up to 'unusedBudget' bytes,
+// and a file already loaded is recognized by its path, size and modification time, so loading it again doesn't read it
+class RomCache
+{
+public:
+	// Check of the header of a newly loaded file, before it is hashed so an invalid file is only touched on its first page
+	typedef bool(*validator_t)(const uint8_t* data, uint32_t size);
+
+	static constexpr uint64_t unusedBudget = 64 << 20;
+
+	// Stats
+	uint64_t hits = 0;			// Image found without reading the file
+	uint64_t sharedLoads = 0;	// File read, but its content was already cached (same ROM under another path, or rewritten)
+	uint64_t misses = 0;
+	uint64_t evictions = 0;
+
+private:
+	struct file_entry_t {
+		uint64_t size;
+		int64_t time;
+		uint64_t hash;
+	};
+
+	std::mutex mutex;
+	std::unordered_map<uint64_t, RomImage*> images;
+	std::unordered_map<std::string, file_entry_t> files;
+
+public:
+	RomCache();
+	~RomCache();
+
+	const RomImage* acquire(const std::string& filename, validator_t isValid);
+	void release(const RomImage* image);
+	void trim();
+
+	uint64_t getCachedBytes();
+	uint64_t getSavedBytes();
+
+	static uint64_t hash(const uint8_t* data, uint32_t size);
+
+private:
+	RomImage* load(const std::string& filename, validator_t isValid);
+	void evict(uint64_t budget);
+};
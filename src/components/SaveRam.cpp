@@ -0,0 +1,340 @@
+#include "SaveRam.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+SaveRam::SaveRam(const std::string& filename, uint32_t size)
+	: size(size), filename(filename) {
+	dirtyPages.resize((size / pageSize + 63) / 64, 0);
+
+	if (!size || !mapFile()) {
+		loadFile();
+	}
+
+	loadTrailer();
+
+	image.assign(data, data + size);
+	imageTrailer = trailer;
+}
+
+SaveRam::~SaveRam() {
+	// Last changes are written before the writer stops
+	commit();
+
+	if (writer.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			isStopping = true;
+		}
+
+		wakeUp.notify_one();
+		writer.join();
+	}
+
+	if (isMapped) {
+#if CARTRIDGE_MMAP && !defined(_WIN32)
+		munmap(data, size);
+#endif
+	}
+	else {
+		delete[] data;
+	}
+}
+
+// Replace the trailer written after the RAM, it's written with the next commit
+void SaveRam::setTrailer(const uint8_t* trailerData, uint32_t trailerSize) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		pendingTrailer.assign(trailerData, trailerData + trailerSize);
+		isTrailerPending = true;
+	}
+
+	isDirty = true;
+}
+
+// Copy the dirty pages for the writer thread and mark them clean, returns false if there was none
+// Called on the emulation thread, it only waits for the writer thread to take the previous pages
+bool SaveRam::commit() {
+	if (!isDirty) {
+		return false;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		for (uint32_t word = 0; word < dirtyPages.size(); word++) {
+			for (uint32_t bit = 0; bit < 64; bit++) {
+				if (dirtyPages[word] & (1ull << bit)) {
+					uint32_t page = word * 64 + bit;
+
+					pendingPages.push_back(page);
+					pendingData.insert(pendingData.end(), data + page * pageSize, data + (page + 1) * pageSize);
+					pagesCommitted++;
+				}
+			}
+
+			dirtyPages[word] = 0;
+		}
+
+		if (!writer.joinable()) {
+			writer = std::thread(&SaveRam::run, this);	// Started on the first commit, most cartridges never save
+		}
+	}
+
+	isDirty = false;
+	commits++;
+
+	return true;
+}
+
+void SaveRam::setFlushInterval(uint32_t milliseconds) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		flushInterval = milliseconds;
+	}
+
+	wakeUp.notify_one();
+}
+
+// Map the save file as the RAM, privately so writes are not sent to the file (returns false if it can't be mapped)
+// Windows can't replace a mapped file, so the mapping is only used to copy it there
+bool SaveRam::mapFile() {
+#if CARTRIDGE_MMAP
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	HANDLE mapping = nullptr;
+
+	if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart >= size) {
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	}
+
+	CloseHandle(file);
+
+	if (!mapping) {
+		return false;
+	}
+
+	void* memory = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, size);
+	CloseHandle(mapping);
+
+	if (!memory) {
+		return false;
+	}
+
+	data = new uint8_t[size];
+	memcpy(data, memory, size);
+	UnmapViewOfFile(memory);
+
+	isMapped = false;
+#else
+	int file = open(filename.c_str(), O_RDONLY);
+
+	if (file < 0) {
+		return false;
+	}
+
+	struct stat status;
+	void* memory = MAP_FAILED;
+
+	// The file can be larger than the RAM (data saved after it), not shorter
+	if (fstat(file, &status) == 0 && status.st_size >= size) {
+		memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+	}
+
+	close(file);
+
+	if (memory == MAP_FAILED) {
+		return false;
+	}
+
+	data = (uint8_t*)memory;
+	isMapped = true;	// Save file is never modified in place, it's replaced, so the mapping stays valid
+#endif
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+// Read what there is of the save file in a buffer, the rest of the RAM is cleared
+void SaveRam::loadFile() {
+	data = new uint8_t[size];
+	memset(data, 0x00, size);
+
+	std::ifstream ifs(filename.c_str(), std::ifstream::binary);
+
+	if (ifs.is_open()) {
+		ifs.read((char*)data, size);
+	}
+
+	isMapped = false;
+}
+
+// Read the data saved after the RAM, if any
+void SaveRam::loadTrailer() {
+	static constexpr uint32_t maxTrailerSize = 0x100;
+
+	std::ifstream ifs(filename.c_str(), std::ifstream::binary);
+
+	if (!ifs.is_open()) {
+		return;
+	}
+
+	ifs.seekg(0, ifs.end);
+	uint64_t fileSize = (uint64_t)ifs.tellg();
+
+	if (fileSize <= size || fileSize - size > maxTrailerSize) {
+		return;
+	}
+
+	trailer.resize((size_t)(fileSize - size));
+
+	ifs.seekg(size, ifs.beg);
+	ifs.read((char*)trailer.data(), trailer.size());
+
+	if (!ifs) {
+		trailer.clear();
+	}
+}
+
+// Writer thread: applies the committed pages to its copy of the RAM and writes it at most once per flush interval
+void SaveRam::run() {
+	std::unique_lock<std::mutex> lock(mutex);
+	std::vector<uint32_t> pages;
+	std::vector<uint8_t> pagesData;
+	auto wakeTime = std::chrono::steady_clock::now();
+
+	while (true) {
+		// The deadline is recomputed on every wake up, so a new flush interval applies to the current wait
+		while (!isStopping && std::chrono::steady_clock::now() < wakeTime + std::chrono::milliseconds(flushInterval)) {
+			wakeUp.wait_until(lock, wakeTime + std::chrono::milliseconds(flushInterval));
+		}
+
+		wakeTime = std::chrono::steady_clock::now();
+		bool isLast = isStopping;
+
+		if (!pendingPages.empty() || isTrailerPending) {
+			pages.swap(pendingPages);
+			pagesData.swap(pendingData);
+
+			if (isTrailerPending) {
+				imageTrailer.swap(pendingTrailer);
+				isTrailerPending = false;
+			}
+
+			lock.unlock();
+
+			for (uint32_t i = 0; i < pages.size(); i++) {
+				memcpy(image.data() + pages[i] * pageSize, pagesData.data() + i * pageSize, pageSize);
+			}
+
+			pages.clear();
+			pagesData.clear();
+
+			bool isWritten = writeFile();
+
+			lock.lock();
+
+			isWritten ? filesWritten++ : writeFailures++;
+		}
+
+		if (isLast) {
+			break;
+		}
+	}
+}
+
+// Write the RAM to a temporary file synced to the disk, then replace the save file with it
+bool SaveRam::writeFile() {
+	std::string temporary = filename + ".tmp";
+	std::error_code error;
+
+	if (!writeSynced(temporary)) {
+		std::filesystem::remove(temporary, error);
+		return false;
+	}
+
+	std::filesystem::rename(temporary, filename, error);
+
+	if (error) {
+		std::filesystem::remove(temporary, error);
+		return false;
+	}
+
+#ifndef _WIN32
+	// The rename itself is only durable once the directory is synced
+	std::filesystem::path directory = std::filesystem::path(filename).parent_path();
+	int directoryFile = open(directory.empty() ? "." : directory.c_str(), O_RDONLY);
+
+	if (directoryFile >= 0) {
+		fsync(directoryFile);
+		close(directoryFile);
+	}
+#endif
+
+	return true;
+}
+
+// Write the RAM and the trailer to a file and wait for them to reach the disk (std::ofstream can't sync)
+bool SaveRam::writeSynced(const std::string& path) {
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	auto write = [file](const std::vector<uint8_t>& buffer) {
+		DWORD written = 0;
+		return buffer.empty() || (WriteFile(file, buffer.data(), (DWORD)buffer.size(), &written, nullptr) && written == buffer.size());
+	};
+
+	bool isWritten = write(image) && write(imageTrailer) && FlushFileBuffers(file);
+
+	return CloseHandle(file) && isWritten;
+#else
+	int file = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+	if (file < 0) {
+		return false;
+	}
+
+	auto write = [file](const std::vector<uint8_t>& buffer) {
+		for (size_t offset = 0; offset < buffer.size();) {
+			ssize_t written = ::write(file, buffer.data() + offset, buffer.size() - offset);
+
+			if (written < 0 && errno != EINTR) {
+				return false;
+			}
+
+			offset += written > 0 ? written : 0;
+		}
+
+		return true;
+	};
+
+	bool isWritten = write(image) && write(imageTrailer) && fsync(file) == 0;
+
+	return close(file) == 0 && isWritten;
+#endif
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../Config.h"
+
+// Battery-backed cartridge RAM, loaded from a save file and written back to it in the background
+// Writes are tracked in 256-byte dirty pages (the pages of the bus). commit() is called on the emulation thread and only
+// copies the dirty pages for the writer thread, which applies them to its own copy of the RAM and writes it to a temporary
+// file renamed over the save file, so the emulation never waits for the disk and a save file is never left half written
+// The file can end with a trailer after the RAM (MBC3 clock), kept as it is unless it's replaced with setTrailer()
+class SaveRam
+{
+public:
+	static constexpr uint32_t pageSize = 0x100;
+
+	uint8_t* data = nullptr;
+	uint32_t size = 0;
+
+	// Stats
+	uint64_t commits = 0;			// Commits with dirty pages
+	uint64_t pagesCommitted = 0;
+	uint64_t filesWritten = 0;		// Updated by the writer thread
+	uint64_t writeFailures = 0;
+
+private:
+	std::string filename;
+	bool isMapped = false;			// Data is a private mapping of the save file, not a buffer
+
+	std::vector<uint64_t> dirtyPages;	// Bitmap of the pages written since the last commit
+	bool isDirty = false;
+
+	std::vector<uint8_t> trailer;	// As loaded
+
+	// Shared with the writer thread
+	std::mutex mutex;
+	std::condition_variable wakeUp;
+	std::thread writer;
+	uint32_t flushInterval = 1000;	// Milliseconds between two writes of the file
+	bool isStopping = false;
+	std::vector<uint32_t> pendingPages;
+	std::vector<uint8_t> pendingData;
+	std::vector<uint8_t> pendingTrailer;
+	bool isTrailerPending = false;
+
+	std::vector<uint8_t> image;		// Writer thread copy of the RAM and trailer
+	std::vector<uint8_t> imageTrailer;
+
+public:
+	SaveRam(const std::string& filename, uint32_t size);
+	~SaveRam();
+
+	// Mark the page of a RAM offset as written, returns true if it was clean
+	bool markDirty(uint32_t offset) {
+		uint32_t page = offset / pageSize;
+		uint64_t bit = 1ull << (page & 63);
+
+		if (dirtyPages[page >> 6] & bit) {
+			return false;
+		}
+
+		dirtyPages[page >> 6] |= bit;
+		isDirty = true;
+
+		return true;
+	}
+
+	bool isPageDirty(uint32_t offset) const { return dirtyPages[offset / pageSize >> 6] & (1ull << (offset / pageSize & 63)); }
+	bool hasChanges() const { return isDirty; }
+
+	const std::vector<uint8_t>& getTrailer() const { return trailer; }
+	void setTrailer(const uint8_t* trailerData, uint32_t trailerSize);
+
+	bool commit();
+	void setFlushInterval(uint32_t milliseconds);
+
+private:
+	bool mapFile();
+	void loadFile();
+	void loadTrailer();
+	void run();
+	bool writeFile();
+	bool writeSynced(const std::string& path);
+};
@@ -0,0 +1,34 @@
+#include "Scheduler.h"
+
+Scheduler::Scheduler() {
+	for (uint8_t i = 0; i < count; i++) {
+		deadlines[i] = never;
+	}
+}
+
+Scheduler::~Scheduler() {
+
+}
+
+// Set the M-cycle at which the event has to be run, replacing its previous deadline
+void Scheduler::schedule(event_t event, uint64_t time) {
+	deadlines[event] = time;
+	update();
+}
+
+void Scheduler::cancel(event_t event) {
+	deadlines[event] = never;
+	update();
+}
+
+void Scheduler::update() {
+	nextDeadline = never;
+	nextEvent = count;
+
+	for (uint8_t i = 0; i < count; i++) {
+		if (deadlines[i] < nextDeadline) {
+			nextDeadline = deadlines[i];
+			nextEvent = (event_t)i;
+		}
+	}
+}
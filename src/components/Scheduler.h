@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+
+// Master clock of the machine and deadlines of the timed events of the components
+// Time is counted in M-cycles on 64 bits, so it never wraps during a run
+// Each event has one slot holding its deadline, the earliest one is cached so checking for due events is a single comparison
+class Scheduler
+{
+public:
+	// Timed events, by priority order when they are due on the same cycle
+	enum event_t : uint8_t {
+		timer,		// Timer interrupt
+		cartridge,	// Commit of the battery-backed RAM
+		count
+	};
+
+	static constexpr uint64_t never = UINT64_MAX;
+
+	uint64_t now = 0;	// M-cycles elapsed since power on
+
+private:
+	uint64_t nextDeadline = never;	// Next to 'now', both are read after each instruction
+	event_t nextEvent = count;
+	uint64_t deadlines[count];
+
+public:
+	Scheduler();
+	~Scheduler();
+
+	void schedule(event_t event, uint64_t time);
+	void cancel(event_t event);
+
+	uint64_t getDeadline(event_t event) const { return deadlines[event]; }
+
+	// Whether an event has to be run before going on
+	bool isDue() const { return now >= nextDeadline; }
+
+	// Earliest event, only valid if one is due, it's cancelled so it can be scheduled again while being run
+	event_t pop() {
+		event_t event = nextEvent;
+		cancel(event);
+		return event;
+	}
+
+private:
+	void update();
+};
@@ -1,5 +1,7 @@
 #include "Serial.h"
 
+#include "../components/Bus.h"
+
 Serial::Serial() {
 
 }
@@ -8,6 +10,12 @@ Serial::~Serial() {
 
 }
 
+void Serial::connectBus(Bus* b) {
+	bus = b;
+
+	bus->mapIO<Serial, &Serial::read, &Serial::write>(0xFF01, 0xFF02, this);
+}
+
 std::string Serial::getOutput() {
 	return output;
 }
@@ -4,9 +4,13 @@
 #include <string>
 #include <stdint.h>
 
+class Bus;
+
 class Serial
 {
 public:
+	Bus* bus = nullptr;
+
 	uint8_t mode = 0;
 	std::string output;
 
@@ -14,6 +18,8 @@ public:
 	Serial();
 	~Serial();
 
+	void connectBus(Bus* b);
+
 	std::string getOutput();
 	void resetOutput();
 	void setMode(uint8_t m);
@@ -1,5 +1,14 @@
 #include "Tester.h"
 
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#include "../utils/RomIndexer.h"
+
 Tester::Tester() {
 	bus.connectCPU(&cpu);
 	bus.connectSerial(&serial);
@@ -16,80 +25,375 @@ bool Tester::ends_with(std::string const& value, std::string const& ending)
 }
 
 void Tester::start() {
-	uint8_t mooneyePassed = 0x00;
-	uint8_t mooneyeFailed = 0x00;
-	uint8_t blarggPassed = 0x00;
-	uint8_t blarggFailed = 0x00;
-	
-	// Testing Mooneye
-	bus.serial->setMode(2);
-	for (int i = 0; i < 14; i++) {
-		cart = new Cartridge(mooneyeTests[i]);
+	// Testing Mooneye and Blargg, interpreted
+	suite_results_t interpreted;
+
+	if (!runSuites(interpreted)) {
+		return;
+	}
+
+#if CPU_BLOCK_CACHE
+	// Testing Mooneye and Blargg again on predecoded blocks
+	suite_results_t cached;
+	cpu.setBlockCache(true);
+
+	if (!runSuites(cached)) {
+		return;
+	}
+
+	std::ostringstream blockCacheStats;
+	blockCacheStats << "\tHits:\t\t" << cpu.blockCache->hits << std::endl;
+	blockCacheStats << "\tMisses:\t\t" << cpu.blockCache->misses << std::endl;
+	blockCacheStats << "\tInvalidations:\t" << cpu.blockCache->invalidations << std::endl;
+	blockCacheStats << "\tUncached:\t" << cpu.blockCache->uncached << std::endl;
+	cached.stats = blockCacheStats.str();
+
+	cpu.setBlockCache(false);
+#endif
+
+#if CPU_JIT
+	// Testing Mooneye and Blargg again with the hot blocks compiled
+	suite_results_t compiled;
+	cpu.setRecompiler(true);
+
+	if (!runSuites(compiled)) {
+		return;
+	}
 
-		if (!cart->isLoaded) {
+	std::ostringstream recompilerStats;
+	recompilerStats << "\tCompiled:\t" << cpu.recompiler->compiled << " blocks" << std::endl;
+	recompilerStats << "\tExecuted:\t" << cpu.recompiler->executed << " blocks, " << cpu.recompiler->instructions << " instructions" << std::endl;
+	recompilerStats << "\tDeferred:\t" << cpu.recompiler->deferred << std::endl;
+	recompilerStats << "\tFlushes:\t" << cpu.recompiler->flushes << std::endl;
+	compiled.stats = recompilerStats.str();
+
+	cpu.setRecompiler(false);
+#endif
+
+	// Testing Blargg on a flat memory
+	// Without serial port, results are read from memory: 0xA000 holds the status (0x80 while running) and 0xA004 the text output,
+	// once the signature DE B0 61 is written at 0xA001
+	uint8_t flatPassed = 0x00;
+	uint8_t flatFailed = 0x00;
+
+	for (int i = 0; i < 10; i++) {
+		FlatMemory* memory = new FlatMemory();
+		CPU<FlatMemory>* flatCpu = new CPU<FlatMemory>();
+
+		memory->connectCPU(flatCpu);
+
+		if (!memory->load(blarggTests[flatTests[i]])) {
 			return;
 		}
 
-		bus.connectCartridge(cart);
-
-		cpu.reset();
+		flatCpu->reset();
 
+		const uint8_t* result = &memory->memory[0xA000];
 		bool testRunning = true;
 
-		while (testRunning) {
-			bus.clock();
+		while (testRunning && flatCpu->instructionCount < flatTestMaxInstructions) {
+			flatCpu->step();
 
-			if (ends_with(serial.getOutput(), "358132134")) {
-				serial.resetOutput();
-				testRunning = false;
-				mooneyePassed++;
+			testRunning = result[1] != 0xDE || result[2] != 0xB0 || result[3] != 0x61 || result[0] == 0x80;
+		}
 
-				std::cout << std::endl << std::endl;
-			}
+		memory->memory[0xFFFF] = 0x00;	// Text output is zero-terminated, the end of the memory is not
+		std::cout << (const char*)&result[4] << std::endl << std::endl;
+
+		if (!testRunning && result[0] == 0x00) {
+			flatPassed++;
+		}
+		else {
+			flatFailed++;
 		}
 
-		delete cart;
+		delete flatCpu;
+		delete memory;
+	}
+
+	std::cout << std::dec;
+
+	std::cout << "==================" << std::endl;
+
+	printResults("", interpreted);
+
+	std::cout << "Blargg tests (flat memory):" << std::endl;
+	std::cout << "\tPassed: " << (int)flatPassed << std::endl;
+	std::cout << "\tFailed: " << (int)flatFailed << std::endl << std::endl;
+
+#if CPU_BLOCK_CACHE
+	printResults("block cache", cached);
+#endif
+
+#if CPU_JIT
+	printResults("recompiler", compiled);
+#endif
+
+#if CPU_IDLE_SKIP
+	std::cout << std::endl << "Polling loops:" << std::endl;
+	std::cout << "\tSkipped:\t" << cpu.idleLoopsSkipped << " times, " << cpu.idleCyclesSkipped << " M-cycles" << std::endl;
+#endif
+
+	RomCache& romCache = Cartridge::romCache;
+	uint64_t romLoads = romCache.hits + romCache.sharedLoads + romCache.misses;
+
+	std::cout << std::endl << "ROM cache:" << std::endl;
+	std::cout << "\tHits:\t\t" << romCache.hits << " without reading the file, " << romCache.sharedLoads << " after reading it"
+		<< " (" << (romLoads ? 100 * (romCache.hits + romCache.sharedLoads) / romLoads : 0) << "%)" << std::endl;
+	std::cout << "\tMisses:\t\t" << romCache.misses << std::endl;
+	std::cout << "\tEvictions:\t" << romCache.evictions << std::endl;
+	std::cout << "\tCached:\t\t" << romCache.getCachedBytes() / 1024 << " KB (" << romCache.getSavedBytes() / 1024 << " KB saved by sharing)" << std::endl;
+
+	cpu.dumpFusions(std::cout);
+
+	benchmarkBus();
+	benchmarkOpcodes();
+	benchmarkIndexer();
+}
+
+// Run the Mooneye and Blargg tests with the current CPU settings, returns false if a test ROM can't be loaded
+bool Tester::runSuites(suite_results_t& results) {
+	auto startTime = std::chrono::steady_clock::now();
+	uint64_t startInstructions = cpu.instructionCount;
+
+	// Testing Mooneye
+	bus.serial->setMode(2);
+	for (int i = 0; i < 14; i++) {
+		test_result_t result = runTest(mooneyeTests[i], "358132134", "666666666666");
+
+		if (result == notLoaded) {
+			return false;
+		}
+
+		result == passed ? results.mooneyePassed++ : results.mooneyeFailed++;
 	}
 
 	// Testing Blargg
 	bus.serial->setMode(1);
 	for (int i = 0; i < 12; i++) {
-		cart = new Cartridge(blarggTests[i]);
+		test_result_t result = runTest(blarggTests[i], "Passed", "Failed");
 
-		if (!cart->isLoaded) {
-			return;
+		if (result == notLoaded) {
+			return false;
 		}
 
-		bus.connectCartridge(cart);
+		result == passed ? results.blarggPassed++ : results.blarggFailed++;
+	}
 
-		cpu.reset();
+	results.elapsed = std::chrono::steady_clock::now() - startTime;
+	results.instructions = cpu.instructionCount - startInstructions;
 
-		bool testRunning = true;
+	return true;
+}
+
+// Run a test ROM until its serial output ends with the passed or failed signature (Mooneye fails with 0x42 six times)
+Tester::test_result_t Tester::runTest(const std::string& filename, const std::string& passedSignature, const std::string& failedSignature) {
+	cart = new Cartridge(filename);
+
+	if (!cart->isLoaded) {
+		delete cart;
+		return notLoaded;
+	}
+
+	bus.connectCartridge(cart);
+
+	cpu.reset();
+
+#if CPU_IDLE_SKIP
+	uint64_t idleCycles = cpu.idleCyclesSkipped;
+#endif
 
-		while (testRunning) {
-			bus.clock();
+	uint64_t maxInstructions = cpu.instructionCount + testMaxInstructions;
+	test_result_t result = failed;
 
-			if (ends_with(serial.getOutput(), "Passed")) {
-				serial.resetOutput();
-				testRunning = false;
-				blarggPassed++;
+	while (cpu.instructionCount < maxInstructions) {
+		bus.step();
 
-				std::cout << std::endl << std::endl;
+		if (ends_with(serial.getOutput(), passedSignature)) {
+			result = passed;
+			break;
+		}
+
+		if (ends_with(serial.getOutput(), failedSignature)) {
+			break;
+		}
+	}
+
+	serial.resetOutput();
+
+	std::cout << std::endl << std::endl;
+
+#if CPU_IDLE_SKIP
+	std::cout << "Polling loops: " << cpu.idleCyclesSkipped - idleCycles << " M-cycles skipped" << std::endl << std::endl;
+#endif
+
+	delete cart;
+
+	return result;
+}
+
+// Print the results of a run of the Mooneye and Blargg tests, named after the CPU settings it was run with (if any)
+void Tester::printResults(const std::string& pass, const suite_results_t& results) {
+	std::string suffix = pass.empty() ? "" : " (" + pass + ")";
+
+	std::cout << "Mooneye tests" << suffix << ":" << std::endl;
+	std::cout << "\tPassed: " << (int)results.mooneyePassed << std::endl;
+	std::cout << "\tFailed: " << (int)results.mooneyeFailed << std::endl << std::endl;
+
+	std::cout << "Blargg tests" << suffix << ":" << std::endl;
+	std::cout << "\tPassed: " << (int)results.blarggPassed << std::endl;
+	std::cout << "\tFailed: " << (int)results.blarggFailed << std::endl << std::endl;
+
+	std::cout << "Performance (" << CPU<Bus>::getDispatchName() << " dispatch, " << CPU<Bus>::getTimingName() << " timing"
+		<< (pass.empty() ? "" : ", " + pass) << "):" << std::endl;
+	std::cout << "\tInstructions:\t" << results.instructions << std::endl;
+	std::cout << "\tElapsed:\t" << results.elapsed.count() << " s" << std::endl;
+	std::cout << "\tSpeed:\t\t" << (uint64_t)(results.instructions / results.elapsed.count()) << " instructions/s" << std::endl;
+	std::cout << results.stats << std::endl;
+}
+
+// Bus reads per second on the regions accessed most by the CPU: ROM (banks 00 and 01) and Work RAM
+void Tester::benchmarkBus() {
+	cart = new Cartridge(blarggTests[0]);
+
+	if (!cart->isLoaded) {
+		return;
+	}
+
+	bus.connectCartridge(cart);
+
+	uint64_t reads = 0;
+	uint32_t checksum = 0;	// Keeps the reads from being optimized out
+
+	auto startTime = std::chrono::steady_clock::now();
+
+	for (uint32_t pass = 0; pass < busBenchmarkPasses; pass++) {
+		for (uint32_t addr = 0x0000; addr <= 0x7FFF; addr++) {
+			checksum += bus.read(addr);
+		}
+
+		for (uint32_t addr = 0xC000; addr <= 0xDFFF; addr++) {
+			checksum += bus.read(addr);
+		}
+
+		reads += 0x8000 + 0x2000;
+	}
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+
+	std::cout << std::endl << "Bus reads (ROM and Work RAM):" << std::endl;
+	std::cout << "\tReads:\t\t" << reads << " (checksum " << std::hex << checksum << std::dec << ")" << std::endl;
+	std::cout << "\tElapsed:\t" << elapsed.count() << " s" << std::endl;
+	std::cout << "\tSpeed:\t\t" << (uint64_t)(reads / elapsed.count()) << " reads/s" << std::endl;
+
+	delete cart;
+}
+
+// Time per instruction of code made of a single opcode repeated, for the opcodes specialized by the switch dispatch
+void Tester::benchmarkOpcodes() {
+	struct opcode_benchmark_t {
+		const char* name;
+		uint8_t bytes[2];
+		uint8_t length;
+	};
+
+	static constexpr opcode_benchmark_t opcodes[] = {
+		{ "NOP", { 0x00 }, 1 },
+		{ "LD B, C", { 0x41 }, 1 },
+		{ "LD B, n8", { 0x06, 0x12 }, 2 },
+		{ "INC B", { 0x04 }, 1 },
+		{ "ADD A, B", { 0x80 }, 1 },
+		{ "XOR A", { 0xAF }, 1 },
+		{ "CP n8", { 0xFE, 0x10 }, 2 },
+		{ "INC BC", { 0x03 }, 1 },
+		{ "ADD HL, BC", { 0x09 }, 1 },
+		{ "SWAP B", { 0xCB, 0x30 }, 2 },
+		{ "BIT 7, H", { 0xCB, 0x7C }, 2 }
+	};
+
+	std::cout << std::endl << "Opcodes (" << CPU<FlatMemory>::getDispatchName() << " dispatch, flat memory):" << std::endl;
+
+	for (const opcode_benchmark_t& op : opcodes) {
+		FlatMemory* memory = new FlatMemory();
+		CPU<FlatMemory>* flatCpu = new CPU<FlatMemory>();
+
+		memory->connectCPU(flatCpu);
+		flatCpu->setFusion(false);
+		flatCpu->setIdleSkip(false);
+
+		// The opcode repeated from 0x0100, then JP 0x0100
+		uint16_t addr = 0x0100;
+
+		while (addr < 0x7F00) {
+			memcpy(&memory->memory[addr], op.bytes, op.length);
+			addr += op.length;
+		}
+
+		memory->memory[addr] = 0xC3;
+		memory->memory[addr + 1] = 0x00;
+		memory->memory[addr + 2] = 0x01;
+
+		flatCpu->reset();
+
+		double best = 0.0;
+
+		for (uint32_t sample = 0; sample < opcodeBenchmarkSamples; sample++) {
+			auto startTime = std::chrono::steady_clock::now();
+
+			for (uint32_t i = 0; i < opcodeBenchmarkInstructions; i++) {
+				flatCpu->step();
+			}
+
+			std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+
+			if (sample == 0 || elapsed.count() < best) {
+				best = elapsed.count();
 			}
 		}
 
-		delete cart;
+		std::cout << "\t" << std::left << std::setw(12) << op.name << std::right << best * 1e9 / opcodeBenchmarkInstructions << " ns" << std::endl;
+
+		delete flatCpu;
+		delete memory;
 	}
+}
 
-	std::cout << std::dec;
+// Index the test ROMs on every core, then check the index written: header, fixed-size entries, then the paths
+void Tester::benchmarkIndexer() {
+	RomIndexer indexer;
 
-	std::cout << "==================" << std::endl;
+	auto startTime = std::chrono::steady_clock::now();
+	size_t files = indexer.scan(indexerDirectory);
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
 
-	std::cout << "Mooneye tests:" << std::endl;
-	std::cout << "\tPassed: " << (int)mooneyePassed << std::endl;
-	std::cout << "\tFailed: " << (int)mooneyeFailed << std::endl << std::endl;
+	bool isWritten = indexer.write(indexerFile);
+	bool isIndexValid = false;
+
+	if (isWritten) {
+		uint64_t pathsSize = 0;
+
+		for (const RomIndexer::rom_entry_t& entry : indexer.entries) {
+			pathsSize += entry.path.size();
+		}
+
+		uint8_t header[12] = {};
+		std::ifstream ifs(indexerFile.c_str(), std::ifstream::binary);
+		ifs.read((char*)header, sizeof(header));
+
+		std::error_code error;
+		uint64_t indexSize = std::filesystem::file_size(indexerFile, error);
+
+		isIndexValid = ifs && !error
+			&& header[0] == 'Z' && header[1] == 'G' && header[2] == 'B' && header[3] == 'I'
+			&& (header[4] | (header[5] << 8)) == RomIndexer::indexVersion
+			&& (header[6] | (header[7] << 8)) == RomIndexer::indexEntrySize
+			&& (header[8] | (header[9] << 8) | (header[10] << 16) | ((uint32_t)header[11] << 24)) == files
+			&& indexSize == sizeof(header) + files * RomIndexer::indexEntrySize + pathsSize;
+	}
 
-	std::cout << "Blargg tests:" << std::endl;
-	std::cout << "\tPassed: " << (int)blarggPassed << std::endl;
-	std::cout << "\tFailed: " << (int)blarggFailed << std::endl;
+	std::cout << std::endl << "ROM indexer (" << indexerDirectory << "):" << std::endl;
+	std::cout << "\tIndexed:\t" << files << " files, " << indexer.invalid << " invalid" << std::endl;
+	std::cout << "\tRead:\t\t" << indexer.bytesRead / 1024 << " KB" << std::endl;
+	std::cout << "\tElapsed:\t" << elapsed.count() << " s" << std::endl;
+	std::cout << "\tIndex:\t\t" << (isIndexValid ? "valid" : isWritten ? "invalid" : "not written") << std::endl;
 }
\ No newline at end of file
@@ -1,18 +1,20 @@
 #pragma once
 
+#include <chrono>
 #include <cstdint>
 #include <string>
 
 #include "../components/Bus.h"
 #include "../components/CPU.h"
 #include "../components/Cartridge.h"
+#include "../components/FlatMemory.h"
 #include "../io/Serial.h"
 
 class Tester
 {
 public:
 	Bus bus;
-	CPU cpu;
+	CPU<Bus> cpu;
 	Cartridge* cart = nullptr;
 	Serial serial;
 
@@ -32,6 +34,24 @@ private:
 		"roms/gb-test-roms-master/cpu_instrs/individual/11-op a,(hl).gb"
 	};
 
+	// A test still running after this many instructions has failed (failing tests may never stop)
+	static constexpr uint64_t testMaxInstructions = 200000000;
+
+	// Blargg tests only needing the CPU and memory (the others need the timer), run a second time on a flat memory
+	const uint8_t flatTests[10] = { 1, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+	static constexpr uint64_t flatTestMaxInstructions = 100000000;
+
+	// Bus reads micro-benchmark, sweeps over ROM and Work RAM
+	static constexpr uint32_t busBenchmarkPasses = 2000;
+
+	// Fixed-opcode loops, on a flat memory so that only the dispatch and the handlers are timed
+	static constexpr uint32_t opcodeBenchmarkInstructions = 100000;
+	static constexpr uint32_t opcodeBenchmarkSamples = 20;	// The fastest sample is kept, the others are slowed down by the host
+
+	// ROM indexer benchmark, over the test ROMs
+	const std::string indexerDirectory = "roms";
+	const std::string indexerFile = "roms/index.zgbi";
+
 	const std::string mooneyeTests[14] = {
 		"roms/mts-20240127-1204-74ae166/acceptance/timer/div_write.gb",
 		"roms/mts-20240127-1204-74ae166/acceptance/timer/rapid_toggle.gb",
@@ -49,6 +69,23 @@ private:
 		"roms/mts-20240127-1204-74ae166/acceptance/instr/daa.gb"
 	};
 
+	enum test_result_t : uint8_t {
+		passed,
+		failed,
+		notLoaded
+	};
+
+	// Results of one run of the Mooneye and Blargg tests
+	struct suite_results_t {
+		uint8_t mooneyePassed = 0;
+		uint8_t mooneyeFailed = 0;
+		uint8_t blarggPassed = 0;
+		uint8_t blarggFailed = 0;
+		uint64_t instructions = 0;
+		std::chrono::duration<double> elapsed = {};
+		std::string stats;	// Counters of the block cache or recompiler used by the run
+	};
+
 public:
 	Tester();
 	~Tester();
@@ -56,5 +93,14 @@ public:
 	bool ends_with(std::string const& value, std::string const& ending);
 
 	void start();
+
+private:
+	bool runSuites(suite_results_t& results);
+	test_result_t runTest(const std::string& filename, const std::string& passedSignature, const std::string& failedSignature);
+	void printResults(const std::string& pass, const suite_results_t& results);
+
+	void benchmarkBus();
+	void benchmarkOpcodes();
+	void benchmarkIndexer();
 };
 
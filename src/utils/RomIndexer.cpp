@@ -0,0 +1,164 @@
+#include "RomIndexer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+
+RomIndexer::RomIndexer() {
+
+}
+
+RomIndexer::~RomIndexer() {
+
+}
+
+// Index the .gb and .gbc files of a directory, replacing the previous entries, returns the number of files indexed
+size_t RomIndexer::scan(const std::string& directory) {
+	entries.clear();
+	bytesRead = 0;
+	invalid = 0;
+
+	std::error_code error;
+	for (auto it = std::filesystem::recursive_directory_iterator(directory, error); !error && it != std::filesystem::recursive_directory_iterator(); it.increment(error)) {
+		std::string extension = it->path().extension().string();
+		std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+
+		if (it->is_regular_file() && (extension == ".gb" || extension == ".gbc")) {
+			rom_entry_t entry;
+			entry.path = std::filesystem::relative(it->path(), directory).generic_string();
+			entries.push_back(entry);
+		}
+	}
+
+	std::sort(entries.begin(), entries.end(), [](const rom_entry_t& a, const rom_entry_t& b) { return a.path < b.path; });
+
+	// Each worker takes the next file not indexed yet, with its own read buffer
+	uint32_t workers = threadCount ? threadCount : std::max(1u, std::thread::hardware_concurrency());
+	workers = (uint32_t)std::min<size_t>(workers, std::max<size_t>(1, entries.size()));
+
+	std::atomic<size_t> next(0);
+	std::vector<uint64_t> workerBytes(workers, 0);
+	std::vector<std::thread> threads;
+
+	for (uint32_t i = 0; i < workers; i++) {
+		threads.emplace_back([this, &directory, &next, &workerBytes, i]() {
+			std::vector<uint8_t> buffer;
+
+			for (size_t index = next++; index < entries.size(); index = next++) {
+				workerBytes[i] += indexFile(directory, entries[index], buffer);
+			}
+		});
+	}
+
+	for (uint32_t i = 0; i < workers; i++) {
+		threads[i].join();
+		bytesRead += workerBytes[i];
+	}
+
+	for (const rom_entry_t& entry : entries) {
+		invalid += !entry.isValid;
+	}
+
+	return entries.size();
+}
+
+// Read the header of a file, then the whole file if its header is valid, returns the number of bytes read
+uint64_t RomIndexer::indexFile(const std::string& directory, rom_entry_t& entry, std::vector<uint8_t>& buffer) {
+	std::ifstream ifs((std::filesystem::path(directory) / entry.path), std::ifstream::binary);
+
+	if (!ifs.is_open()) {
+		return 0;
+	}
+
+	ifs.seekg(0, ifs.end);
+	uint64_t size = (uint64_t)ifs.tellg();
+	ifs.seekg(0, ifs.beg);
+
+	if (size < 0x0150 || size > UINT32_MAX) {
+		return 0;
+	}
+
+	entry.size = (uint32_t)size;
+
+	buffer.resize(0x0150);
+	ifs.read((char*)buffer.data(), 0x0150);
+
+	entry.isValid = ifs && Cartridge::parseHeader(buffer.data(), 0x0150, entry.info);
+
+	if (!entry.isValid || !isContentChecked) {
+		return 0x0150;
+	}
+
+	buffer.resize(entry.size);
+	ifs.read((char*)buffer.data() + 0x0150, entry.size - 0x0150);
+
+	if (!ifs) {
+		entry.isValid = false;
+		return 0x0150;
+	}
+
+	entry.hash = RomCache::hash(buffer.data(), entry.size);
+	entry.isGlobalChecksumValid = Cartridge::computeGlobalChecksum(buffer.data(), entry.size) == entry.info.globalChecksum;
+
+	return entry.size;
+}
+
+// Write the entries to a binary index
+// Entry: hash (8), file size (4), path offset and length (4 + 2), global checksum (2), ROM and RAM sizes (4 + 4),
+// type, version, header checksum, flags (1 each: valid, header checksum valid, global checksum valid, content checked, battery),
+// title (16, null-padded), header fields are zero for invalid files
+bool RomIndexer::write(const std::string& filename) const {
+	std::vector<uint8_t> data;
+	std::string paths;
+
+	auto put = [&data](uint64_t value, uint8_t bytes) {
+		for (uint8_t i = 0; i < bytes; i++) {
+			data.push_back((uint8_t)(value >> (i * 8)));
+		}
+	};
+
+	data.insert(data.end(), { 'Z', 'G', 'B', 'I' });
+	put(indexVersion, 2);
+	put(indexEntrySize, 2);
+	put(entries.size(), 4);
+
+	for (const rom_entry_t& entry : entries) {
+		const Cartridge::cart_info_t& info = entry.info;
+
+		put(entry.hash, 8);
+		put(entry.size, 4);
+		put(paths.size(), 4);
+		put(entry.path.size(), 2);
+		put(entry.isValid ? info.globalChecksum : 0, 2);
+		put(entry.isValid ? info.romSize : 0, 4);
+		put(entry.isValid ? info.ramSize : 0, 4);
+		put(entry.isValid ? info.type : 0, 1);
+		put(entry.isValid ? info.version : 0, 1);
+		put(entry.isValid ? info.headerChecksum : 0, 1);
+		put((entry.isValid ? 0x01 : 0)
+			| (entry.isValid && info.isHeaderChecksumValid ? 0x02 : 0)
+			| (entry.isGlobalChecksumValid ? 0x04 : 0)
+			| (entry.isValid && isContentChecked ? 0x08 : 0)
+			| (entry.isValid && info.hasBattery ? 0x10 : 0), 1);
+
+		for (uint8_t i = 0; i < 0x10; i++) {
+			data.push_back(entry.isValid ? (uint8_t)info.title[i] : 0);
+		}
+
+		paths += entry.path;
+	}
+
+	std::ofstream ofs(filename.c_str(), std::ofstream::binary | std::ofstream::trunc);
+
+	if (!ofs.is_open()) {
+		return false;
+	}
+
+	ofs.write((const char*)data.data(), data.size());
+	ofs.write(paths.data(), paths.size());
+
+	return (bool)ofs;
+}
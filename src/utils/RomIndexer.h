@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "../components/Cartridge.h"
+
+// Catalog of the ROMs of a directory (and its subdirectories), built on every core without loading any cartridge
+// The header of each file is read first, and only the files with a valid header are then read whole to verify their
+// global checksum and hash their content (same hash as the ROM cache), unless 'isContentChecked' is false
+class RomIndexer
+{
+public:
+	struct rom_entry_t {
+		std::string path;				// Relative to the scanned directory
+		uint32_t size = 0;				// File size
+		uint64_t hash = 0;				// Content hash (0 if the content is not checked)
+		bool isValid = false;			// Header is valid, 'info' is set
+		bool isGlobalChecksumValid = false;
+		Cartridge::cart_info_t info;
+	};
+
+	std::vector<rom_entry_t> entries;	// Sorted by path
+
+	bool isContentChecked = true;
+	uint32_t threadCount = 0;			// 0 for one per core
+
+	// Stats
+	uint64_t bytesRead = 0;
+	uint64_t invalid = 0;
+
+	// On disk index: a header ("ZGBI", version, count), fixed-size little-endian entries, then the paths
+	static constexpr uint16_t indexVersion = 1;
+	static constexpr uint32_t indexEntrySize = 48;
+
+public:
+	RomIndexer();
+	~RomIndexer();
+
+	size_t scan(const std::string& directory);
+	bool write(const std::string& filename) const;
+
+private:
+	uint64_t indexFile(const std::string& directory, rom_entry_t& entry, std::vector<uint8_t>& buffer);
+};
@@ -12,6 +12,17 @@ Timer::~Timer() {
 
 void Timer::connectBus(Bus* b) {
 	bus = b;
+
+#if TIMER_LAZY
+	bus->mapIO<Timer, &Timer::read, &Timer::write, &Timer::sync>(0xFF04, 0xFF06, this);
+	bus->mapIO<Timer, &Timer::read, &Timer::write, &Timer::sync>(0xFF07, 0xFF07, this, 0xF8);	// Only the 3 lower bits of TAC are used
+
+	lastSync = bus->scheduler.now;
+	schedule();
+#else
+	bus->mapIO<Timer, &Timer::read, &Timer::write>(0xFF04, 0xFF06, this);
+	bus->mapIO<Timer, &Timer::read, &Timer::write>(0xFF07, 0xFF07, this, 0xF8);	// Only the 3 lower bits of TAC are used
+#endif
 }
 
 uint8_t Timer::read(uint16_t addr) {
@@ -61,6 +72,10 @@ void Timer::write(uint16_t addr, uint8_t data) {
 		updateTAC(data);
 		break;
 	}
+
+#if TIMER_LAZY
+	schedule();	// Next interrupt moves with the registers
+#endif
 }
 
 void Timer::clock() {
@@ -75,7 +90,7 @@ void Timer::clock() {
 
 		if (!timaJustSet) {
 			tima = tma; // TIMA Register reset to the value of the TMA Register
-			bus->write(0xFF0F, bus->getInterruptFlags() | Bus::interrupt_flags_t::t); // Schedule timer interrupt
+			bus->interrupts.request(InterruptController::timer); // Schedule timer interrupt
 		}
 	}
 
@@ -86,6 +101,34 @@ void Timer::clock() {
 	updateCounter(counter + 1);
 }
 
+// Advance the timer by several M-cycles at once, they have to end before the next interrupt (cycles < getCyclesToInterrupt())
+void Timer::fastForward(uint32_t cycles) {
+	if (cycles == 0) {
+		return;
+	}
+
+	// Flags are cleared on the first M-Cycle (TIMA can't be reloading, the interrupt would be raised on it)
+	justReload = false;
+	timaJustSet = false;
+
+	// TIMA is incremented each time the counter reach a multiple of twice the modulo bit (falling edge of this bit)
+	// At most the last increment can overflow TIMA
+	if (tac & 0b100) {
+		uint32_t period = modulo_bit[tac & 0b11] << 1;
+		uint32_t increments = (counter + cycles) / period - counter / period;
+		uint32_t value = tima + increments;
+
+		tima = (uint8_t)value;
+
+		if (value > 0xFF) {
+			isReloading = true;
+		}
+	}
+
+	counter = (uint16_t)(counter + cycles);
+	divider = counter >> 6;
+}
+
 void Timer::updateCounter(uint16_t v) {
 	// TIMA Register is incremented if the 3rd bit of TAC Register is set
 	// &&
@@ -120,6 +163,48 @@ void Timer::updateTAC(uint8_t v) {
 	tac = 0xF8 | (v & 0b111); // Only the 3 lower bits are writable (others are set to 1)
 }
 
+// Number of clock() calls until the one raising the timer interrupt, if no register is written in between
+// Returns UINT32_MAX if the timer is disabled
+uint32_t Timer::getCyclesToInterrupt() const {
+	// Interrupt is raised on the next M-Cycle
+	if (isReloading) {
+		return 1;
+	}
+
+	if (!(tac & 0b100)) {
+		return UINT32_MAX;
+	}
+
+	// TIMA is incremented each time the counter reach a multiple of twice the modulo bit (falling edge of this bit)
+	uint32_t period = modulo_bit[tac & 0b11] << 1;
+	uint32_t toIncrement = period - (counter & (period - 1));
+
+	// The interrupt is raised 1 M-Cycle after the increment overflowing TIMA
+	return toIncrement + (0xFF - tima) * period + 1;
+}
+
+// Number of clock() calls until the one changing a register, if no register is written in between
+// Returns UINT32_MAX if it can't change
+uint32_t Timer::getCyclesToChange(uint16_t addr) const {
+	switch (addr)
+	{
+	case 0xFF04:	// Divider Register
+		return 64 - (counter & 0x3F);
+	case 0xFF05:	// TIMA Register
+		if (isReloading) {
+			return 1;
+		}
+
+		if (tac & 0b100) {
+			uint32_t period = modulo_bit[tac & 0b11] << 1;
+			return period - (counter & (period - 1));
+		}
+		break;
+	}
+
+	return UINT32_MAX;
+}
+
 void Timer::incrementTIMA() {
 	tima++;
 
@@ -130,3 +215,56 @@ void Timer::incrementTIMA() {
 		isReloading = true;
 	}
 }
+
+// Stop or restart the timer along with the CPU, the divider is reset when it's stopped
+void Timer::setStopped(bool stopped) {
+#if TIMER_LAZY
+	sync();
+#endif
+
+	isStopped = stopped;
+
+	if (stopped) {
+		divider = 0x00;
+	}
+
+#if TIMER_LAZY
+	schedule();
+#endif
+}
+
+#if TIMER_LAZY
+// Bring the timer up to the current M-cycle of the scheduler
+// It's fast forwarded up to each interrupt, and clocked on the M-cycle raising it (there are at most a few ones,
+// the interrupt event makes sure the timer is synced on each of them)
+void Timer::sync() {
+	uint64_t cycles = isStopped ? 0 : bus->scheduler.now - lastSync;
+
+	while (cycles > 0) {
+		uint32_t toInterrupt = getCyclesToInterrupt();
+
+		if (cycles < toInterrupt) {
+			fastForward((uint32_t)cycles);
+			break;
+		}
+
+		fastForward(toInterrupt - 1);
+		clock();
+		cycles -= toInterrupt;
+	}
+
+	lastSync = bus->scheduler.now;
+}
+
+// Schedule the interrupt event, the timer has to be synced
+void Timer::schedule() {
+	uint32_t toInterrupt = getCyclesToInterrupt();
+
+	if (toInterrupt == UINT32_MAX || isStopped) {
+		bus->scheduler.cancel(Scheduler::timer);
+	}
+	else {
+		bus->scheduler.schedule(Scheduler::timer, lastSync + toInterrupt);
+	}
+}
+#endif
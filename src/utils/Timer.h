@@ -2,6 +2,8 @@
 
 #include <stdint.h>
 
+#include "../Config.h"
+
 class Bus;
 
 class Timer
@@ -27,6 +29,12 @@ public:
 	bool justReload = false;
 	bool isReloading = false;
 
+	bool isStopped = false;		// Timer doesn't run while the CPU is stopped
+
+#if TIMER_LAZY
+	uint64_t lastSync = 0;		// M-cycle of the scheduler the timer is up to date with
+#endif
+
 public:
 	Timer();
 	~Timer();
@@ -37,8 +45,18 @@ public:
 	void write(uint16_t addr, uint8_t data);
 
 	void clock();
+	void fastForward(uint32_t cycles);
 	void updateCounter(uint16_t v);
 	void updateTAC(uint8_t v);
 	void incrementTIMA();
+	void setStopped(bool stopped);
+
+#if TIMER_LAZY
+	void sync();
+	void schedule();
+#endif
+
+	uint32_t getCyclesToInterrupt() const;
+	uint32_t getCyclesToChange(uint16_t addr) const;
 };
 